@@ -0,0 +1,204 @@
+/*
+Copyright (C) 2019 by andersama <anderson.john.alexander@gmail.com>
+and pkv <pkv.stream@gmail.com>.
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <avrt.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "asio-dispatcher.h"
+
+#include <util/platform.h>
+#include <obs-module.h>
+#include <algorithm>
+#include <string.h>
+
+#define blog(level, msg, ...) blog(level, "asio-input: " msg, ##__VA_ARGS__)
+
+void DispatcherThread::set_scheduling(const dispatcher_scheduling &s)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (scheduling == s)
+			return;
+		scheduling = s;
+	}
+	if (isThreadRunning()) {
+		stopThread(1000);
+		start();
+	}
+}
+
+static dispatcher_scheduling strongest(const std::map<const void *, dispatcher_scheduling> &requests)
+{
+	if (requests.empty())
+		return {10, false, -1};
+
+	dispatcher_scheduling s          = {0, false, -1};
+	int                   cpu_weight = -1;
+	for (const auto &r : requests) {
+		const dispatcher_scheduling &q = r.second;
+		s.priority                     = std::max(s.priority, q.priority);
+		s.realtime                     = s.realtime || q.realtime;
+		if (q.cpu < 0)
+			continue;
+		int weight = q.priority + (q.realtime ? 1 : 0);
+		if (weight > cpu_weight || (weight == cpu_weight && q.cpu < s.cpu)) {
+			cpu_weight = weight;
+			s.cpu      = q.cpu;
+		}
+	}
+	return s;
+}
+
+void DispatcherThread::request_scheduling(const void *owner, const dispatcher_scheduling &s)
+{
+	dispatcher_scheduling resolved;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		requests[owner] = s;
+		resolved        = strongest(requests);
+	}
+	set_scheduling(resolved);
+}
+
+void DispatcherThread::drop_scheduling(const void *owner)
+{
+	dispatcher_scheduling resolved;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!requests.erase(owner))
+			return;
+		resolved = strongest(requests);
+	}
+	set_scheduling(resolved);
+}
+
+dispatcher_scheduling DispatcherThread::current_scheduling()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return scheduling;
+}
+
+void DispatcherThread::start()
+{
+	int priority;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		priority = scheduling.priority;
+	}
+	startThread(priority);
+}
+
+void DispatcherThread::apply_scheduling(const dispatcher_scheduling &s, void **mmcss)
+{
+	*mmcss = nullptr;
+	if (s.cpu >= 0 && s.cpu < 32)
+		juce::Thread::setCurrentThreadAffinityMask((juce::uint32)1 << s.cpu);
+	if (!s.realtime)
+		return;
+
+#ifdef _WIN32
+	DWORD  task   = 0;
+	HANDLE handle = AvSetMmThreadCharacteristicsW(L"Pro Audio", &task);
+	if (handle) {
+		AvSetMmThreadPriority(handle, AVRT_PRIORITY_HIGH);
+		*mmcss = handle;
+	} else {
+		blog(LOG_WARNING, "MMCSS refused the dispatcher (%lu), staying at priority %d", GetLastError(),
+				s.priority);
+	}
+#else
+	sched_param param    = {};
+	param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+	if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0)
+		blog(LOG_WARNING, "SCHED_FIFO refused for the dispatcher, staying at priority %d", s.priority);
+#endif
+}
+
+void DispatcherThread::report(const dispatcher_scheduling &s, bool final)
+{
+	if (!wakes)
+		return;
+
+	uint64_t p99    = 0;
+	uint64_t target = wakes - wakes / 100;
+	uint64_t seen   = 0;
+	for (int i = 0; i < latency_buckets; i++) {
+		seen += histogram[i];
+		if (seen >= target) {
+			p99 = (uint64_t)(i + 1) * 50;
+			break;
+		}
+	}
+	blog(final ? LOG_INFO : LOG_DEBUG,
+			"Dispatcher wake-up latency (priority %d%s, cpu %d): %llu wakes, avg %llu us, p99 < %llu us, "
+			"max %llu us",
+			s.priority, s.realtime ? " real-time" : "", s.cpu, (unsigned long long)wakes,
+			(unsigned long long)(late_total / wakes / 1000), (unsigned long long)p99,
+			(unsigned long long)(late_max / 1000));
+}
+
+void DispatcherThread::record_wake(uint64_t expected_ns, uint64_t now_ns)
+{
+	uint64_t late = now_ns > expected_ns ? now_ns - expected_ns : 0;
+	int      b    = (int)std::min<uint64_t>(late / 50000, latency_buckets - 1);
+	histogram[b]++;
+	wakes++;
+	late_total += late;
+	late_max = std::max(late_max, late);
+
+	// a periodic summary for long sessions, the full one goes out when the scheduling changes or we stop
+	if (now_ns - last_report > 60000000000ULL) {
+		dispatcher_scheduling s;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			s = scheduling;
+		}
+		report(s, false);
+		last_report = now_ns;
+	}
+}
+
+void DispatcherThread::run()
+{
+	dispatcher_scheduling s;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		s = scheduling;
+	}
+	void *mmcss = nullptr;
+	apply_scheduling(s, &mmcss);
+
+	runs++;
+	wakes       = 0;
+	late_total  = 0;
+	late_max    = 0;
+	last_report = os_gettime_ns();
+	memset(histogram, 0, sizeof(histogram));
+
+	juce::TimeSliceThread::run();
+
+	report(s, true);
+#ifdef _WIN32
+	if (mmcss)
+		AvRevertMmThreadCharacteristics((HANDLE)mmcss);
+#endif
+}
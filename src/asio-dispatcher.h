@@ -0,0 +1,80 @@
+/*
+Copyright (C) 2019 by andersama <anderson.john.alexander@gmail.com>
+and pkv <pkv.stream@gmail.com>.
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <juce_core/juce_core.h>
+
+struct dispatcher_scheduling {
+	int  priority; /* juce thread priority, 0 - 10 */
+	bool realtime; /* MMCSS "Pro Audio" on windows, SCHED_FIFO elsewhere, falls back to priority if refused */
+	int  cpu;      /* core to pin to, -1 for any */
+
+	bool operator==(const dispatcher_scheduling &other) const
+	{
+		return priority == other.priority && realtime == other.realtime && cpu == other.cpu;
+	}
+};
+
+// The thread delivering ring blocks to the listeners. Every source asks for a scheduling and the thread runs with the
+// strongest of them: the highest priority, real-time if any source wants it, and the core pinned by the highest
+// priority source that pins one (the lowest core on a tie). Scheduling is applied from inside the thread when it
+// starts, changing it restarts the thread. Listeners report how late they were woken compared to the wait they
+// asked for, which is summarised in the log for every scheduling the thread ran with.
+class DispatcherThread : public juce::TimeSliceThread {
+private:
+	static const int latency_buckets = 200; // 50us each, the last one collects everything above 10ms
+
+	std::mutex                                    mutex;
+	dispatcher_scheduling                         scheduling = {10, false, -1};
+	std::map<const void *, dispatcher_scheduling> requests;
+
+	// only touched on the dispatcher thread
+	uint32_t runs       = 0;
+	uint64_t wakes      = 0;
+	uint64_t late_total = 0;
+	uint64_t late_max   = 0;
+	uint64_t last_report;
+	uint32_t histogram[latency_buckets];
+
+	void set_scheduling(const dispatcher_scheduling &s);
+	void apply_scheduling(const dispatcher_scheduling &s, void **mmcss);
+	void report(const dispatcher_scheduling &s, bool final);
+
+public:
+	DispatcherThread(const juce::String &name) : juce::TimeSliceThread(name)
+	{
+	}
+
+	// owner is the requesting source, requests stay until it drops them
+	void request_scheduling(const void *owner, const dispatcher_scheduling &s);
+	void drop_scheduling(const void *owner);
+	dispatcher_scheduling current_scheduling();
+	void start();
+
+	// called by listeners on the dispatcher thread
+	void record_wake(uint64_t expected_ns, uint64_t now_ns);
+
+	// counts the times the thread was started, a wake asked for in an earlier run is not measured against this one
+	uint32_t run_count() const
+	{
+		return runs;
+	}
+
+	void run() override;
+};
@@ -0,0 +1,139 @@
+/*
+Copyright (C) 2019 by andersama <anderson.john.alexander@gmail.com>
+and pkv <pkv.stream@gmail.com>.
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "asio-dsp.h"
+#include "asio-simd.h"
+
+static inline float db_to_mul(float db)
+{
+	return powf(10.0f, db / 20.0f);
+}
+
+void AsioDsp::configure(const asio_dsp_params &params, uint32_t sample_rate)
+{
+	float rate = (float)std::max(sample_rate, 1u);
+	for (int c = 0; c < MAX_AV_PLANES; c++)
+		gain[c] = db_to_mul(params.gain_db[c]);
+
+	// RBJ cookbook high-pass, Q = 1/sqrt(2)
+	hpf = params.hpf_hz > 0.0f && params.hpf_hz < rate * 0.45f;
+	if (hpf) {
+		float w0    = 2.0f * 3.14159265f * params.hpf_hz / rate;
+		float cosw  = cosf(w0);
+		float alpha = sinf(w0) / (2.0f * 0.70710678f);
+		float a0    = 1.0f + alpha;
+		b0          = (1.0f + cosw) / 2.0f / a0;
+		b1          = -(1.0f + cosw) / a0;
+		b2          = b0;
+		a1          = -2.0f * cosw / a0;
+		a2          = (1.0f - alpha) / a0;
+	}
+
+	gate = params.gate;
+	if (gate) {
+		open_threshold  = db_to_mul(params.gate_open_db);
+		close_threshold = db_to_mul(params.gate_close_db);
+		// 10ms peak envelope, linear gain ramps over the attack and release times
+		decay        = expf(-1.0f / (rate * 0.01f));
+		attack       = 1.0f / std::max(params.gate_attack_ms * rate / 1000.0f, 1.0f);
+		release      = 1.0f / std::max(params.gate_release_ms * rate / 1000.0f, 1.0f);
+		hold_samples = params.gate_hold_ms * rate / 1000.0f;
+	}
+}
+
+void AsioDsp::reset()
+{
+	for (int c = 0; c < MAX_AV_PLANES; c++) {
+		z1[c]        = 0.0f;
+		z2[c]        = 0.0f;
+		env[c]       = 0.0f;
+		held[c]      = 0.0f;
+		open[c]      = 0.0f;
+		gate_gain[c] = 0.0f;
+	}
+}
+
+void AsioDsp::process(const uint8_t *const *in, enum audio_format format, float *const *out, int channels,
+		int frames)
+{
+#ifdef ASIO_SSE2
+	// recursive filters decaying into denormals would crawl, flush them for the duration of the block
+	unsigned int csr = _mm_getcsr();
+	_mm_setcsr(csr | 0x8040);
+#endif
+	channels = std::min(channels, MAX_AV_PLANES);
+	for (int base = 0; base < channels; base += 4) {
+		int lanes = std::min(channels - base, 4);
+		v4  g     = v4_load(gain + base);
+		v4  s1    = v4_load(z1 + base);
+		v4  s2    = v4_load(z2 + base);
+		v4  e     = v4_load(env + base);
+		v4  h     = v4_load(held + base);
+		v4  o     = v4_load(open + base);
+		v4  gg    = v4_load(gate_gain + base);
+		v4  zero  = v4_set(0.0f);
+		v4  one   = v4_set(1.0f);
+
+		for (int i = 0; i < frames; i++) {
+			float lane[4] = {};
+			for (int l = 0; l < lanes; l++)
+				lane[l] = load_sample(in[base + l], i, format);
+			v4 x = v4_load(lane) * g;
+
+			if (hpf) {
+				// transposed direct form II
+				v4 y = v4_set(b0) * x + s1;
+				s1   = v4_set(b1) * x - v4_set(a1) * y + s2;
+				s2   = v4_set(b2) * x - v4_set(a2) * y;
+				x    = y;
+			}
+
+			if (gate) {
+				e          = v4_max(v4_abs(x), e * v4_set(decay));
+				m4 is_open = o > v4_set(0.5f);
+				m4 below   = e < v4_set(close_threshold);
+				h          = v4_select(is_open & below, h + one, zero);
+				m4 closing = is_open & below & (h > v4_set(hold_samples));
+				is_open    = (is_open | (e > v4_set(open_threshold))) & ~closing;
+				v4 opening = v4_min(gg + v4_set(attack), one);
+				v4 closed  = v4_max(gg - v4_set(release), zero);
+				o          = v4_select(is_open, one, zero);
+				gg         = v4_select(is_open, opening, closed);
+				x          = x * gg;
+			}
+
+			v4_store(lane, x);
+			for (int l = 0; l < lanes; l++)
+				out[base + l][i] = lane[l];
+		}
+
+		float state[4];
+		v4_store(state, s1);
+		std::copy(state, state + lanes, z1 + base);
+		v4_store(state, s2);
+		std::copy(state, state + lanes, z2 + base);
+		v4_store(state, e);
+		std::copy(state, state + lanes, env + base);
+		v4_store(state, h);
+		std::copy(state, state + lanes, held + base);
+		v4_store(state, o);
+		std::copy(state, state + lanes, open + base);
+		v4_store(state, gg);
+		std::copy(state, state + lanes, gate_gain + base);
+	}
+#ifdef ASIO_SSE2
+	_mm_setcsr(csr);
+#endif
+}
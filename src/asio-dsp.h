@@ -0,0 +1,58 @@
+/*
+Copyright (C) 2019 by andersama <anderson.john.alexander@gmail.com>
+and pkv <pkv.stream@gmail.com>.
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <obs-module.h>
+#include <stdint.h>
+
+struct asio_dsp_params {
+	float gain_db[MAX_AV_PLANES];
+	float hpf_hz; /* 0 disables the high-pass */
+	bool  gate;
+	float gate_open_db;
+	float gate_close_db;
+	float gate_attack_ms;
+	float gate_hold_ms;
+	float gate_release_ms;
+};
+
+// Gain, 2nd order high-pass and noise gate per channel, fused into one pass over the block. Channels are processed
+// four at a time, one per SIMD lane, so every stage runs on the sample while it is in a register.
+class AsioDsp {
+private:
+	// per channel coefficients
+	float gain[MAX_AV_PLANES];
+	float b0 = 1.0f, b1 = 0.0f, b2 = 0.0f, a1 = 0.0f, a2 = 0.0f;
+	bool  hpf  = false;
+	bool  gate = false;
+	float open_threshold, close_threshold, decay, attack, release, hold_samples;
+
+	// per channel state, kept across blocks
+	float z1[MAX_AV_PLANES]        = {};
+	float z2[MAX_AV_PLANES]        = {};
+	float env[MAX_AV_PLANES]       = {};
+	float held[MAX_AV_PLANES]      = {};
+	float open[MAX_AV_PLANES]      = {};
+	float gate_gain[MAX_AV_PLANES] = {};
+
+public:
+	// can be called between blocks, the filter and gate state carries over
+	void configure(const asio_dsp_params &params, uint32_t sample_rate);
+	void reset();
+
+	// in holds channels planes of format (planar), out receives float planes. in and out may not overlap.
+	void process(const uint8_t *const *in, enum audio_format format, float *const *out, int channels, int frames);
+};
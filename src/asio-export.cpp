@@ -0,0 +1,301 @@
+/*
+Copyright (C) 2019 by andersama <anderson.john.alexander@gmail.com>
+and pkv <pkv.stream@gmail.com>.
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "asio-export.h"
+
+#include <obs-module.h>
+#include <new>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define blog(level, msg, ...) blog(level, "asio-input: " msg, ##__VA_ARGS__)
+
+static uint64_t align_up(uint64_t v)
+{
+	return (v + 63) & ~(uint64_t)63;
+}
+
+static std::string export_name(const char *device_name)
+{
+	std::string name = "obs-asio-";
+	for (const char *c = device_name; *c; c++) {
+		bool alnum = (*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9');
+		name.push_back(alnum ? *c : '_');
+	}
+#ifdef _WIN32
+	return "Local\\" + name;
+#else
+	return "/" + name;
+#endif
+}
+
+static std::string notify_name(const std::string &name, int reader)
+{
+	return name + "-notify-" + std::to_string(reader);
+}
+
+static uint32_t current_pid()
+{
+#ifdef _WIN32
+	return (uint32_t)GetCurrentProcessId();
+#else
+	return (uint32_t)getpid();
+#endif
+}
+
+static bool process_gone(uint32_t pid)
+{
+#ifdef _WIN32
+	HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, (DWORD)pid);
+	if (!process)
+		return GetLastError() == ERROR_INVALID_PARAMETER;
+	bool exited = WaitForSingleObject(process, 0) == WAIT_OBJECT_0;
+	CloseHandle(process);
+	return exited;
+#else
+	return kill((pid_t)pid, 0) != 0 && errno == ESRCH;
+#endif
+}
+
+// a segment left behind by a process that is gone (or by this one) can be taken over, any other is in use
+static bool stale_owner(uint32_t pid)
+{
+	if (pid == 0)
+		return false;
+	return pid == current_pid() || process_gone(pid);
+}
+
+#ifndef _WIN32
+static bool stale_segment(const char *name)
+{
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	bool        stale = false;
+	if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(asio_export_header)) {
+		void *view = mmap(nullptr, sizeof(asio_export_header), PROT_READ, MAP_SHARED, fd, 0);
+		if (view != MAP_FAILED) {
+			stale = stale_owner(((const asio_export_header *)view)->owner_pid);
+			munmap(view, sizeof(asio_export_header));
+		}
+	}
+	close(fd);
+	return stale;
+}
+#endif
+
+AsioExport *AsioExport::create(const char *device_name, uint32_t format, uint32_t samples_per_sec, int channels,
+		int frames, int slot_count)
+{
+	uint32_t sample_size = (uint32_t)get_audio_bytes_per_channel((enum audio_format)format);
+	uint64_t plane_size  = align_up((uint64_t)frames * sample_size);
+	uint64_t slots_at    = align_up(sizeof(asio_export_header));
+	uint64_t data_at     = align_up(slots_at + sizeof(asio_export_slot) * slot_count);
+	uint64_t size        = data_at + plane_size * channels * slot_count;
+
+	AsioExport *ex = new AsioExport();
+	ex->_name      = export_name(device_name);
+	ex->_size      = (size_t)size;
+
+#ifdef _WIN32
+	HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)(size >> 32),
+			(DWORD)(size & 0xffffffff), ex->_name.c_str());
+	if (!mapping) {
+		blog(LOG_WARNING, "Could not create shared memory %s (%lu)", ex->_name.c_str(), GetLastError());
+		delete ex;
+		return nullptr;
+	}
+	ex->_mapping = mapping;
+	// the name lives on while anyone has it open, reuse it only if whoever created it is gone
+	if (GetLastError() == ERROR_ALREADY_EXISTS) {
+		void *view  = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, sizeof(asio_export_header));
+		bool  stale = view && stale_owner(((const asio_export_header *)view)->owner_pid);
+		if (view)
+			UnmapViewOfFile(view);
+		if (!stale) {
+			blog(LOG_WARNING, "Shared memory %s is in use by another process, not exporting",
+					ex->_name.c_str());
+			delete ex;
+			return nullptr;
+		}
+	}
+	ex->_owned = true;
+	ex->_base  = (uint8_t *)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, ex->_size);
+	for (int i = 0; i < ASIO_EXPORT_MAX_READERS; i++)
+		ex->_notify[i] = CreateSemaphoreA(NULL, 0, LONG_MAX, notify_name(ex->_name, i).c_str());
+#else
+	int fd  = shm_open(ex->_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+	int err = fd < 0 ? errno : 0;
+	if (err == EEXIST && stale_segment(ex->_name.c_str())) {
+		shm_unlink(ex->_name.c_str());
+		fd  = shm_open(ex->_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+		err = fd < 0 ? errno : 0;
+	}
+	if (fd < 0) {
+		if (err == EEXIST)
+			blog(LOG_WARNING, "Shared memory %s is in use by another process, not exporting",
+					ex->_name.c_str());
+		else
+			blog(LOG_WARNING, "Could not create shared memory %s", ex->_name.c_str());
+		delete ex;
+		return nullptr;
+	}
+	ex->_owned = true;
+	if (ftruncate(fd, (off_t)size) != 0) {
+		blog(LOG_WARNING, "Could not size shared memory %s", ex->_name.c_str());
+		close(fd);
+		delete ex;
+		return nullptr;
+	}
+	void *base = mmap(nullptr, ex->_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	ex->_base = base == MAP_FAILED ? nullptr : (uint8_t *)base;
+	// the semaphore names go with the segment name, which is ours now, so any left over are stale
+	for (int i = 0; i < ASIO_EXPORT_MAX_READERS; i++) {
+		std::string name = notify_name(ex->_name, i);
+		sem_unlink(name.c_str());
+		sem_t *sem     = sem_open(name.c_str(), O_CREAT | O_EXCL, 0600, 0);
+		ex->_notify[i] = sem == SEM_FAILED ? nullptr : sem;
+	}
+#endif
+	bool notify = true;
+	for (int i = 0; i < ASIO_EXPORT_MAX_READERS; i++)
+		notify = notify && ex->_notify[i];
+	if (!ex->_base || !notify) {
+		blog(LOG_WARNING, "Could not map shared memory %s", ex->_name.c_str());
+		delete ex;
+		return nullptr;
+	}
+
+	asio_export_header *header = new (ex->_base) asio_export_header();
+	header->format             = format;
+	header->samples_per_sec    = samples_per_sec;
+	header->channels           = (uint32_t)channels;
+	header->frames             = (uint32_t)frames;
+	header->slot_count         = (uint32_t)slot_count;
+	header->sample_size        = sample_size;
+	header->slot_table_offset  = slots_at;
+	header->data_offset        = data_at;
+	header->plane_size         = plane_size;
+	header->owner_pid          = current_pid();
+	header->write_seq.store(0, std::memory_order_relaxed);
+	for (int i = 0; i < ASIO_EXPORT_MAX_READERS; i++)
+		header->reader_table[i].attached.store(0, std::memory_order_relaxed);
+
+	ex->_header = header;
+	ex->_slots  = (asio_export_slot *)(ex->_base + slots_at);
+	for (int i = 0; i < slot_count; i++) {
+		asio_export_slot *slot = new (&ex->_slots[i]) asio_export_slot();
+		slot->sequence.store(ASIO_EXPORT_WRITING, std::memory_order_relaxed);
+	}
+
+	// a reader that maps the segment early must not trust the layout before the magic shows up
+	header->version = ASIO_EXPORT_VERSION;
+	std::atomic_thread_fence(std::memory_order_release);
+	header->magic = ASIO_EXPORT_MAGIC;
+
+	blog(LOG_INFO, "Exporting %d channels to shared memory %s", channels, ex->_name.c_str());
+	return ex;
+}
+
+AsioExport::~AsioExport()
+{
+	if (_header)
+		_header->magic = 0;
+#ifdef _WIN32
+	if (_base)
+		UnmapViewOfFile(_base);
+	if (_mapping)
+		CloseHandle((HANDLE)_mapping);
+	for (int i = 0; i < ASIO_EXPORT_MAX_READERS; i++) {
+		if (_notify[i])
+			CloseHandle((HANDLE)_notify[i]);
+	}
+#else
+	if (_base)
+		munmap(_base, _size);
+	for (int i = 0; i < ASIO_EXPORT_MAX_READERS; i++) {
+		if (_notify[i])
+			sem_close((sem_t *)_notify[i]);
+	}
+	if (_owned) {
+		shm_unlink(_name.c_str());
+		for (int i = 0; i < ASIO_EXPORT_MAX_READERS; i++)
+			sem_unlink(notify_name(_name, i).c_str());
+	}
+#endif
+}
+
+void AsioExport::begin_write(int slot)
+{
+	_slots[slot].sequence.store(ASIO_EXPORT_WRITING, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+void AsioExport::publish(int slot, uint64_t seq, uint64_t timestamp, int frames)
+{
+	_slots[slot].timestamp = timestamp;
+	_slots[slot].frames    = (uint32_t)frames;
+	_slots[slot].sequence.store(seq, std::memory_order_release);
+	_header->write_seq.store(seq + 1, std::memory_order_release);
+
+	// a few seconds apart at any buffer size, looking up processes is not for every block
+	if ((seq & 1023) == 1023)
+		reclaim_readers();
+
+	// each attached reader gets one post on its own semaphore, so no reader can take another's wake up
+	for (int i = 0; i < ASIO_EXPORT_MAX_READERS; i++) {
+		if (!_header->reader_table[i].attached.load(std::memory_order_relaxed))
+			continue;
+#ifdef _WIN32
+		ReleaseSemaphore((HANDLE)_notify[i], 1, NULL);
+#else
+		sem_post((sem_t *)_notify[i]);
+#endif
+	}
+}
+
+void AsioExport::reclaim_readers()
+{
+	for (int i = 0; i < ASIO_EXPORT_MAX_READERS; i++) {
+		uint32_t pid = _header->reader_table[i].attached.load(std::memory_order_relaxed);
+		if (!pid || !process_gone(pid))
+			continue;
+		// only this thread posts, so the count drained here cannot grow again before the entry is free
+#ifdef _WIN32
+		while (WaitForSingleObject((HANDLE)_notify[i], 0) == WAIT_OBJECT_0) {
+		}
+#else
+		while (sem_trywait((sem_t *)_notify[i]) == 0) {
+		}
+#endif
+		if (_header->reader_table[i].attached.compare_exchange_strong(pid, 0, std::memory_order_relaxed))
+			blog(LOG_INFO, "Freed reader %d of %s, process %u exited without detaching", i, _name.c_str(),
+					pid);
+	}
+}
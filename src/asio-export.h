@@ -0,0 +1,117 @@
+/*
+Copyright (C) 2019 by andersama <anderson.john.alexander@gmail.com>
+and pkv <pkv.stream@gmail.com>.
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+
+/* Shared memory export of a device ring.
+ *
+ * The segment is named "obs-asio-<device>" (with "Local\" on windows and "/" elsewhere, every character outside
+ * [A-Za-z0-9] replaced by '_'). Each entry i of the reader table has its own notification semaphore, named like the
+ * segment followed by "-notify-<i>", which is posted once per block while the entry is attached.
+ *
+ * A reader maps the segment, checks magic/version, claims a free reader table entry by swapping attached from 0 to
+ * its process id, then waits on that entry's semaphore. Every block with a sequence below write_seq is in slot
+ * (sequence % slot_count). A slot's sequence reads ASIO_EXPORT_WRITING while the driver thread is filling it;
+ * readers using a block in place should re-check the slot sequence afterwards to know it was not overwritten
+ * underneath them. Readers set attached back to 0 when they detach. Every few seconds the writer frees entries whose
+ * process has exited without detaching, so a reader may be woken for blocks published before it attached.
+ *
+ * The segment is only created if no running process owns the name, so a second OBS instance exporting the same
+ * device does not export at all rather than share the first one's segment.
+ */
+
+#define ASIO_EXPORT_MAGIC 0x4f495341 /* "ASIO" */
+#define ASIO_EXPORT_VERSION 3
+#define ASIO_EXPORT_MAX_READERS 8
+#define ASIO_EXPORT_WRITING UINT64_MAX
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "the export header needs lock free 64 bit atomics");
+
+struct asio_export_slot {
+	std::atomic<uint64_t> sequence;
+	uint64_t              timestamp;
+	uint32_t              frames;
+	uint32_t              reserved;
+};
+
+struct asio_export_reader {
+	std::atomic<uint32_t> attached; /* process id of the reader, 0 while free */
+	uint32_t              reserved;
+};
+
+struct asio_export_header {
+	uint32_t              magic;
+	uint32_t              version;
+	uint32_t              format; /* enum audio_format, always planar */
+	uint32_t              samples_per_sec;
+	uint32_t              channels;
+	uint32_t              frames; /* capacity of one slot, in frames */
+	uint32_t              slot_count;
+	uint32_t              sample_size;
+	uint64_t              slot_table_offset;
+	uint64_t              data_offset; /* plane (s, c) starts at data_offset + (s * channels + c) * plane_size */
+	uint64_t              plane_size;
+	std::atomic<uint64_t> write_seq;
+	uint32_t              owner_pid; /* process that created the segment */
+	uint32_t              reserved;
+	asio_export_reader    reader_table[ASIO_EXPORT_MAX_READERS];
+};
+
+class AsioExport {
+private:
+	std::string         _name;
+	size_t              _size    = 0;
+	uint8_t            *_base    = nullptr;
+	asio_export_header *_header  = nullptr;
+	asio_export_slot   *_slots   = nullptr;
+	void               *_mapping = nullptr;
+	// one semaphore per reader table entry
+	void *_notify[ASIO_EXPORT_MAX_READERS] = {};
+	// only the instance that created the names removes them again
+	bool _owned = false;
+
+	AsioExport() = default;
+
+	// frees the reader table entries of processes that exited without detaching, on the driver thread
+	void reclaim_readers();
+
+public:
+	AsioExport(const AsioExport &) = delete;
+	AsioExport &operator=(const AsioExport &) = delete;
+	~AsioExport();
+
+	// returns nullptr (and logs why) if the segment could not be created
+	static AsioExport *create(const char *device_name, uint32_t format, uint32_t samples_per_sec, int channels,
+			int frames, int slot_count);
+
+	const char *name() const
+	{
+		return _name.c_str();
+	}
+
+	uint8_t *plane(int slot, int channel) const
+	{
+		return _base + _header->data_offset +
+		       ((uint64_t)slot * _header->channels + (uint64_t)channel) * _header->plane_size;
+	}
+
+	// called on the driver thread around filling a ring slot
+	void begin_write(int slot);
+	void publish(int slot, uint64_t seq, uint64_t timestamp, int frames);
+};
@@ -22,8 +22,14 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <util/bmem.h>
 #include <util/platform.h>
+#include <util/util_uint64.h>
 #include <obs-module.h>
 #include <obs-frontend-api.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <set>
 #include <vector>
 //#include <JuceHeader.h>
 #include <juce_core/juce_core.h>
@@ -37,18 +43,32 @@ using namespace juce;
 #include <QString>
 #include <QLabel>
 
+#include "asio-dispatcher.h"
+#include "asio-dsp.h"
+#include "asio-export.h"
+#include "asio-jitter.h"
+#include "asio-loudness.h"
+#include "asio-ring.h"
+#include "asio-simd.h"
+#include "asio-trace.h"
+
 OBS_DECLARE_MODULE()
 OBS_MODULE_USE_DEFAULT_LOCALE("win-asio", "en-US")
 
 #define blog(level, msg, ...) blog(level, "asio-input: " msg, ##__VA_ARGS__)
 
+// longest per-source delay, in frames
+#define MAX_DELAY_FRAMES 480000
+
 static void fill_out_devices(obs_property_t *prop);
 
 static juce::AudioIODeviceType *deviceTypeAsio = AudioIODeviceType::createAudioIODeviceType_ASIO();
 
 class ASIOPlugin;
 class AudioCB;
-TimeSliceThread *global_thread;
+DispatcherThread *global_thread;
+// loudness analysis, kept well below the dispatcher so it only uses time the capture path does not need
+TimeSliceThread *analysis_thread;
 
 static bool asio_device_changed(void *vptr, obs_properties_t *props, obs_property_t *list, obs_data_t *settings);
 static bool asio_layout_changed(obs_properties_t *props, obs_property_t *list, obs_data_t *settings);
@@ -56,6 +76,16 @@ static bool fill_out_channels_modified(obs_properties_t *props, obs_property_t *
 
 static std::vector<AudioCB *> callbacks;
 
+// trace replay devices go through the same callbacks as the ASIO ones
+static AudioIODevice *create_device(const std::string &name)
+{
+	AudioIODevice *device = create_trace_device(name);
+	if (device)
+		return device;
+	String deviceName = name.c_str();
+	return deviceTypeAsio->createDevice(deviceName, deviceName);
+}
+
 enum audio_format string_to_obs_audio_format(std::string format)
 {
 	if (format == "32 Bit Int") {
@@ -96,6 +126,72 @@ int bytedepth_format(audio_format format)
 	return (int)get_audio_bytes_per_channel(format);
 }
 
+// ring format for a driver of the given bit depth. 16 bit drivers are kept at 16 bits and 24 bit ones in 32 bit ints,
+// which is lossless either way. 32 bit drivers may be float so they stay float.
+static audio_format native_ring_format(int bit_depth)
+{
+	switch (bit_depth) {
+	case 16:
+		return AUDIO_FORMAT_16BIT_PLANAR;
+	case 24:
+		return AUDIO_FORMAT_32BIT_PLANAR;
+	default:
+		return AUDIO_FORMAT_FLOAT_PLANAR;
+	}
+}
+
+// converts one plane of driver samples into the ring's sample format, scaled by 2^15 or 2^31 like load_sample
+// reads them back so driver data round trips exactly, and saturated at full scale
+static void convert_plane(const float *src, uint8_t *dst, int frames, audio_format format)
+{
+	int i = 0;
+	switch (format) {
+	case AUDIO_FORMAT_16BIT_PLANAR: {
+		int16_t *out = (int16_t *)dst;
+#ifdef ASIO_SSE2
+		const __m128 scale = _mm_set1_ps(32768.0f);
+		const __m128 lo    = _mm_set1_ps(-32768.0f);
+		const __m128 hi    = _mm_set1_ps(32767.0f);
+		for (; i + 8 <= frames; i += 8) {
+			__m128 a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i), scale), lo), hi);
+			__m128 b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i + 4), scale), lo), hi);
+			_mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+		}
+#endif
+		for (; i < frames; i++)
+			out[i] = (int16_t)lrintf(std::min(std::max(src[i] * 32768.0f, -32768.0f), 32767.0f));
+		break;
+	}
+	case AUDIO_FORMAT_32BIT_PLANAR: {
+		// no float holds 2^31 - 1, so full scale and above is caught before the conversion and saturated
+		int32_t *out = (int32_t *)dst;
+#ifdef ASIO_SSE2
+		const __m128 scale = _mm_set1_ps(2147483648.0f);
+		const __m128 lo    = _mm_set1_ps(-2147483648.0f);
+		for (; i + 4 <= frames; i += 4) {
+			__m128  a    = _mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i), scale), lo);
+			__m128i over = _mm_castps_si128(_mm_cmpge_ps(a, scale));
+			// out of range converts to 0x80000000, flipping its bits gives INT32_MAX
+			_mm_storeu_si128((__m128i *)(out + i), _mm_xor_si128(_mm_cvtps_epi32(a), over));
+		}
+#endif
+		for (; i < frames; i++) {
+			double v = (double)src[i] * 2147483648.0;
+			out[i]   = v >= 2147483647.0 ? INT32_MAX : v <= -2147483648.0 ? INT32_MIN : (int32_t)lrint(v);
+		}
+		break;
+	}
+	default:
+		memcpy(dst, src, (size_t)frames * sizeof(float));
+		break;
+	}
+}
+
+static inline uint64_t frames_to_ns(int64_t frames, uint32_t sample_rate)
+{
+	return util_mul_div64((uint64_t)frames, 1000000000ULL, sample_rate);
+}
+
 // get number of output channels (this is set in obs general audio settings
 int get_obs_output_channels()
 {
@@ -134,27 +230,67 @@ static std::vector<std::string> known_layouts_str = {"Mono", "Stereo", "2.1", "4
 
 class AudioCB : public juce::AudioIODeviceCallback {
 private:
-	AudioIODevice   *_device      = nullptr;
-	char            *_name        = nullptr;
-	int              _write_index = 0;
-	double           sample_rate;
-	TimeSliceThread *_thread       = nullptr;
-	uint64_t         last_audio_ts = 0;
+	AudioIODevice        *_device          = nullptr;
+	char                 *_name            = nullptr;
+	std::atomic<uint64_t> _overruns        = {0};
+	AsioExport           *_export          = nullptr;
+	AsioTrace            *_trace           = nullptr;
+	double                sample_rate;
+	int                   block_frames  = 0;
+	DispatcherThread     *_thread       = nullptr;
+	uint64_t              last_audio_ts = 0;
+	JitterBuffer          _jitter;
+	std::atomic<int>      _jitter_requests = {0};
+	// set when the last request goes, the driver thread then resets the buffer once instead of on every block
+	std::atomic<bool> _jitter_reset = {false};
 
 public:
-	struct AudioBufferInfo {
-		AudioBuffer<float> buffer;
-		obs_source_audio   out;
+	// options that change how the ring is laid out, they take effect when the device (re)starts
+	enum RingOption {
+		RING_EXPORT,        // ring lives in a shared memory segment
+		RING_NATIVE_FORMAT, // ring stores samples at the driver's bit depth
+		RING_OPTIONS
 	};
 
-	int write_index()
+	// sequence number of the next block the driver thread will write, every block below it is readable
+	uint64_t write_sequence()
 	{
-		return _write_index;
+		return _ring.write_sequence();
+	}
+
+	uint64_t overruns()
+	{
+		return _overruns.load(std::memory_order_relaxed);
+	}
+
+	const JitterBuffer &jitter()
+	{
+		return _jitter;
+	}
+
+	size_t ring_size()
+	{
+		return _ring.size();
+	}
+
+	// readers enter it through a ReadGuard for each pass and take no leases outside one
+	AsioRing &ring()
+	{
+		return _ring;
+	}
+
+	bool lease(uint64_t seq, AsioRing::Lease &lease)
+	{
+		return _ring.lease(seq, lease);
 	}
 
 private:
-	std::vector<AudioBufferInfo> buffers;
-	AudioBuffer<float>           silent_ab;
+	AsioRing           _ring;
+	AudioBuffer<float> silent_ab;
+	std::atomic<int>   _ring_requests[RING_OPTIONS] = {};
+	bool               _ring_applied[RING_OPTIONS]  = {};
+	std::mutex         _delay_mutex;
+	std::multiset<int> _delays;
 
 public:
 	class AudioListener : public TimeSliceClient {
@@ -165,28 +301,71 @@ public:
 		obs_source_t      *source;
 
 		bool     active;
-		int      read_index = 0;
-		int      wait_time  = 4;
+		uint64_t read_seq  = 0;
+		int      wait_time = 4;
+		uint16_t trace_id  = 0;
+
+		// delay in frames applied to delivery and the one the source asks for, delay_pending holds the frames
+		// of silence (> 0) still to insert or of input (< 0) still to skip to move from one to the other
+		int64_t              delay         = 0;
+		int64_t              delay_pending = 0;
+		std::atomic<int64_t> target_delay  = {0};
+
+		// optional fused gain / high-pass / gate stage, setDsp hands new parameters over under dsp_mutex
+		AsioDsp            dsp;
+		bool               dsp_enabled = false;
+		uint32_t           dsp_rate    = 0;
+		std::vector<float> dsp_out;
+		std::mutex         dsp_mutex;
+		std::atomic<bool>  dsp_dirty           = {false};
+		bool               dsp_pending_enabled = false;
+		asio_dsp_params    dsp_pending         = {};
+
+		// runs the block through the processing stage into dsp_out and points out at the result
+		void apply_dsp(obs_source_audio &out, int ochs)
+		{
+			if (dsp_dirty.exchange(false) || (dsp_enabled && dsp_rate != out.samples_per_sec)) {
+				std::lock_guard<std::mutex> lock(dsp_mutex);
+				if (dsp_pending_enabled && !dsp_enabled)
+					dsp.reset();
+				dsp_enabled = dsp_pending_enabled;
+				dsp_rate    = out.samples_per_sec;
+				dsp.configure(dsp_pending, dsp_rate);
+			}
+			if (!dsp_enabled || ochs <= 0)
+				return;
+
+			size_t frames = out.frames;
+			if (dsp_out.size() < frames * ochs)
+				dsp_out.resize(frames * ochs);
+			float *planes[MAX_AV_PLANES];
+			for (int i = 0; i < ochs; i++)
+				planes[i] = dsp_out.data() + i * frames;
+			dsp.process(out.data, out.format, planes, ochs, (int)frames);
+			for (int i = 0; i < ochs; i++)
+				out.data[i] = (const uint8_t *)planes[i];
+			out.format = AUDIO_FORMAT_FLOAT_PLANAR;
+		}
 		AudioCB *callback;
 		AudioCB *current_callback;
 
 		size_t   silent_buffer_size = 0;
 		uint8_t *silent_buffer      = nullptr;
 
-		bool set_data(AudioBufferInfo *info, const AudioBuffer<float> &sb, obs_source_audio &out,
+		bool set_data(AsioRing::Slot *info, const AudioBuffer<float> &sb, obs_source_audio &out,
 				const std::vector<short> &route, int *sample_rate)
 		{
 			out.speakers        = in.speakers;
 			out.samples_per_sec = info->out.samples_per_sec;
-			out.format          = AUDIO_FORMAT_FLOAT_PLANAR;
+			out.format          = info->out.format;
 			out.timestamp       = info->out.timestamp;
-			out.frames          = info->buffer.getNumSamples();
+			out.frames          = info->out.frames;
 
 			*sample_rate = out.samples_per_sec;
 
-			int       ichs              = info->buffer.getNumChannels();
+			int       ichs              = info->channels;
 			int       ochs              = get_audio_channels(out.speakers);
-			uint8_t **data              = (uint8_t **)(info->buffer.getArrayOfWritePointers());
+			uint8_t **data              = info->planes.data();
 			uint8_t **sb_data           = (uint8_t **)(sb.getArrayOfReadPointers());
 			uint8_t  *silent_buffer_ptr = sb_data[0];
 
@@ -199,13 +378,51 @@ public:
 					out.data[i] = silent_buffer_ptr;
 				}
 			}
+			apply_dsp(out, ochs);
 			return !muted;
 		}
 
+		// a longer delay opens a gap ahead of the held block, fill it with the silence that is due by until so
+		// timestamps stay contiguous and nothing reaches obs late; each frame of the gap is due as long after
+		// its timestamp as the block itself is
+		void fill_gap(const AsioRing::Slot *info, uint64_t until)
+		{
+			if (delay_pending <= 0)
+				return;
+			uint32_t       rate          = info->out.samples_per_sec;
+			const uint8_t *silent_ptr    = (const uint8_t *)callback->silent_ab.getReadPointer(0);
+			int64_t        silent_frames = callback->silent_ab.getNumSamples();
+
+			obs_source_audio gap = {};
+			gap.speakers         = in.speakers;
+			gap.samples_per_sec  = rate;
+			gap.format           = dsp_enabled ? AUDIO_FORMAT_FLOAT_PLANAR : info->out.format;
+			int ochs             = get_audio_channels(gap.speakers);
+			for (int i = 0; i < ochs; i++)
+				gap.data[i] = silent_ptr;
+
+			while (delay_pending > 0) {
+				uint64_t offset = frames_to_ns(delay - delay_pending, rate);
+				uint64_t due    = info->release + offset;
+				if (due > until)
+					break;
+				int64_t frames = delay_pending;
+				if (until != UINT64_MAX)
+					frames = (int64_t)util_mul_div64(until - due, rate, 1000000000ULL) + 1;
+				frames = std::min(std::min(frames, delay_pending), silent_frames);
+				gap.frames    = (uint32_t)frames;
+				gap.timestamp = info->out.timestamp + offset;
+				obs_source_output_audio(source, &gap);
+				delay_pending -= frames;
+			}
+		}
+
 	public:
 		AudioListener(obs_source_t *source, AudioCB *cb) : source(source), callback(cb)
 		{
-			active = true;
+			static std::atomic<uint16_t> next_trace_id = {0};
+			active                                     = true;
+			trace_id                                   = next_trace_id++;
 		}
 
 		~AudioListener()
@@ -233,6 +450,7 @@ public:
 		void setCurrentCallback(AudioCB *cb)
 		{
 			current_callback = cb;
+			next_wake.store(0, std::memory_order_relaxed);
 		}
 
 		void setCallback(AudioCB *cb)
@@ -240,9 +458,24 @@ public:
 			callback = cb;
 		}
 
-		void setReadIndex(int idx)
+		void setReadSequence(uint64_t seq)
 		{
-			read_index = idx;
+			read_seq      = seq;
+			delay         = target_delay.load();
+			delay_pending = 0;
+		}
+
+		void setDelay(int64_t frames)
+		{
+			target_delay = frames;
+		}
+
+		void setDsp(bool enabled, const asio_dsp_params &params)
+		{
+			std::lock_guard<std::mutex> lock(dsp_mutex);
+			dsp_pending_enabled = enabled;
+			dsp_pending         = params;
+			dsp_dirty           = true;
 		}
 
 		void setRoute(std::vector<short> route)
@@ -255,30 +488,278 @@ public:
 			return callback;
 		}
 
+		// when the dispatcher was asked to come back, to measure how late it actually does; 0 after the
+		// listener was (re)attached, which other threads do, and ignored if set in another run of the thread
+		std::atomic<uint64_t> next_wake = {0};
+		uint32_t              wake_run  = 0;
+
 		int useTimeSlice()
+		{
+			uint64_t now      = os_gettime_ns();
+			uint64_t expected = next_wake.load(std::memory_order_relaxed);
+			uint32_t run      = global_thread->run_count();
+			if (run != wake_run)
+				expected = 0;
+			wake_run = run;
+			if (expected) {
+				global_thread->record_wake(expected, now);
+				AsioTrace *trace = callback ? callback->trace() : nullptr;
+				uint32_t   late  = now > expected ? (uint32_t)((now - expected) / 1000) : 0;
+				// only wakes late by a histogram bucket or more, so the trace keeps its history
+				if (trace && late >= 50)
+					trace->record(ASIO_TRACE_WAKE, now, read_seq, late, trace_id);
+			}
+			int wait = deliver();
+			next_wake.store(wait >= 0 ? now + (uint64_t)wait * 1000000 : 0, std::memory_order_relaxed);
+			return wait;
+		}
+
+		int deliver()
 		{
 			if (!active || callback != current_callback)
 				return -1;
-			int write_index = callback->write_index();
-			if (read_index == write_index)
+			// the ring is being laid out again, nothing in it is readable until that is done
+			AsioRing::ReadGuard guard(callback->ring());
+			if (!guard)
+				return wait_time;
+			uint64_t write_seq = callback->write_sequence();
+			if (read_seq == write_seq)
 				return wait_time;
 
 			_route_out.assign(_route.begin(), _route.end());
-			int sample_rate     = 0;
-			int max_sample_rate = 1;
-			int m               = (int)callback->buffers.size();
+			int        sample_rate     = 0;
+			int        max_sample_rate = 0;
+			AsioTrace *trace           = callback->trace();
+
+			uint64_t now          = os_gettime_ns();
+			uint64_t next_release = 0;
+
+			auto take = [&](uint64_t seq, AsioRing::Slot &slot) {
+				AsioRing::Slot *info = &slot;
+				uint32_t        rate = info->out.samples_per_sec;
+
+				int64_t target = target_delay.load(std::memory_order_relaxed);
+				if (target != delay) {
+					delay_pending += target - delay;
+					delay = target;
+				}
+				// blocks stay in the ring until they are released and their delay has elapsed
+				if (info->release + frames_to_ns(delay, rate) > now) {
+					next_release = info->release + frames_to_ns(delay, rate);
+					fill_gap(info, now);
+					return false;
+				}
+				fill_gap(info, UINT64_MAX);
 
-			while (read_index != write_index) {
 				obs_source_audio out;
-				bool unmuted = set_data(&callback->buffers[read_index], callback->silent_ab, out,
-						_route_out, &sample_rate);
+				bool unmuted = set_data(info, callback->silent_ab, out, _route_out, &sample_rate);
+				int  ochs    = get_audio_channels(out.speakers);
+
+				// a shorter delay overlaps what was already delivered, skip that many input frames
+				if (delay_pending < 0) {
+					uint32_t skip  = (uint32_t)std::min(-delay_pending, (int64_t)out.frames);
+					size_t   bytes = (size_t)skip * bytedepth_format(out.format);
+					for (int i = 0; i < ochs; i++)
+						out.data[i] += bytes;
+					out.frames -= skip;
+					out.timestamp += frames_to_ns(skip, rate);
+					delay_pending += skip;
+				}
+				out.timestamp += frames_to_ns(delay, rate);
+
 				// if (unmuted && out.speakers)
-				obs_source_output_audio(source, &out);
+				if (out.frames)
+					obs_source_output_audio(source, &out);
+				if (trace)
+					trace->record(ASIO_TRACE_DELIVER, os_gettime_ns(), seq, out.frames, trace_id);
 				max_sample_rate = (sample_rate > max_sample_rate) ? sample_rate : max_sample_rate;
-				read_index      = (read_index + 1) % m;
+				return true;
+			};
+			auto missed = [&](uint64_t first, uint64_t count) {
+				if (trace)
+					trace->record(ASIO_TRACE_MISS, os_gettime_ns(), first, (uint32_t)count,
+							trace_id);
+			};
+			callback->ring().read(read_seq, take, missed);
+
+			// come back when the held block is due rather than a whole wait later; only a pass that
+			// delivered something knows the rate, the others keep the wait the last delivery set
+			if (max_sample_rate)
+				wait_time = ring_reader_wait_ms(max_sample_rate, now, 0);
+			return ring_reader_wait_ms(max_sample_rate, now, next_release);
+		}
+	};
+
+	// Measures the loudness of one source's routed channels. It reads the ring on its own, on the analysis thread,
+	// and lets the driver get at most half a ring ahead, so its leases never hold up a write. Results are published
+	// in atomics any thread can read.
+	class LoudnessAnalyzer : public TimeSliceClient {
+	private:
+		AudioCB           *callback = nullptr;
+		uint64_t           read_seq = 0;
+		LoudnessMeter      meter;
+		uint32_t           meter_rate = 0;
+		std::vector<float> scratch;
+
+		// route and layout handed over by setRoute under config_mutex
+		std::mutex         config_mutex;
+		std::atomic<bool>  config_dirty     = {false};
+		std::vector<short> pending_route;
+		speaker_layout     pending_speakers = SPEAKERS_UNKNOWN;
+		std::vector<short> route;
+		speaker_layout     speakers         = SPEAKERS_UNKNOWN;
+		std::atomic<bool>  reset_pending    = {false};
+
+		std::atomic<float>    _momentary  = {-INFINITY};
+		std::atomic<float>    _short_term = {-INFINITY};
+		std::atomic<float>    _integrated = {-INFINITY};
+		std::atomic<float>    _true_peak[MAX_AV_PLANES];
+		std::atomic<uint64_t> _missed = {0};
+
+		void publish()
+		{
+			_momentary.store(meter.momentary(), std::memory_order_relaxed);
+			_short_term.store(meter.short_term(), std::memory_order_relaxed);
+			_integrated.store(meter.integrated(), std::memory_order_relaxed);
+			for (int c = 0; c < MAX_AV_PLANES; c++)
+				_true_peak[c].store(meter.true_peak(c), std::memory_order_relaxed);
+		}
+
+	public:
+		LoudnessAnalyzer()
+		{
+			for (int c = 0; c < MAX_AV_PLANES; c++)
+				_true_peak[c].store(-INFINITY);
+		}
+
+		AudioCB *getCallback()
+		{
+			return callback;
+		}
+
+		// only while the analyzer is off the analysis thread
+		void setCallback(AudioCB *cb)
+		{
+			callback   = cb;
+			read_seq   = cb ? cb->write_sequence() : 0;
+			meter_rate = 0;
+			_missed    = 0;
+		}
+
+		void setRoute(const std::vector<short> &r, speaker_layout layout)
+		{
+			std::lock_guard<std::mutex> lock(config_mutex);
+			// update() runs on every settings change, only hand over real changes so integration carries on
+			if (r == pending_route && layout == pending_speakers)
+				return;
+			pending_route    = r;
+			pending_speakers = layout;
+			config_dirty     = true;
+		}
+
+		// starts integrated loudness and true peak hold over
+		void reset()
+		{
+			reset_pending = true;
+		}
+
+		float momentary()
+		{
+			return _momentary.load(std::memory_order_relaxed);
+		}
+
+		float short_term()
+		{
+			return _short_term.load(std::memory_order_relaxed);
+		}
+
+		float integrated()
+		{
+			return _integrated.load(std::memory_order_relaxed);
+		}
+
+		float true_peak(int channel)
+		{
+			if (channel < 0 || channel >= MAX_AV_PLANES)
+				return -INFINITY;
+			return _true_peak[channel].load(std::memory_order_relaxed);
+		}
+
+		// blocks the driver overwrote before the analyzer got to them since the measurement started, the
+		// published loudness has holes while this is not 0
+		uint64_t missed()
+		{
+			return _missed.load(std::memory_order_relaxed);
+		}
+
+		int useTimeSlice()
+		{
+			if (!callback)
+				return -1;
+			if (config_dirty.exchange(false)) {
+				std::lock_guard<std::mutex> lock(config_mutex);
+				route = pending_route;
+				// a new layout changes the channel weights, which starts the measurement over
+				if (speakers != pending_speakers)
+					meter_rate = 0;
+				speakers = pending_speakers;
+			}
+			if (reset_pending.exchange(false)) {
+				meter.reset();
+				_missed.store(0, std::memory_order_relaxed);
+			}
+
+			AsioRing::ReadGuard guard(callback->ring());
+			uint64_t            write_seq = callback->write_sequence();
+			uint64_t            m         = guard ? callback->ring_size() : 0;
+			if (m == 0)
+				return 10;
+			if (write_seq - read_seq > m / 2) {
+				_missed.fetch_add(write_seq - m / 2 - read_seq, std::memory_order_relaxed);
+				read_seq = write_seq - m / 2;
 			}
-			wait_time = ((1000 / 2) * AUDIO_OUTPUT_FRAMES) / max_sample_rate;
-			return wait_time;
+
+			while (read_seq != write_seq) {
+				AsioRing::Lease lease;
+				if (!callback->lease(read_seq++, lease)) {
+					_missed.fetch_add(1, std::memory_order_relaxed);
+					continue;
+				}
+				AsioRing::Slot *info   = lease.get();
+				int             frames = (int)info->out.frames;
+				if (info->out.samples_per_sec != meter_rate) {
+					meter.configure(info->out.samples_per_sec, speakers);
+					meter_rate = info->out.samples_per_sec;
+					_missed.store(0, std::memory_order_relaxed);
+				}
+
+				// copy the routed planes out so the lease is only held for the conversion
+				int ochs = meter.channel_count();
+				if (scratch.size() < (size_t)frames * ochs)
+					scratch.resize((size_t)frames * ochs);
+				const float *planes[MAX_AV_PLANES];
+				for (int c = 0; c < ochs; c++) {
+					float *dst = scratch.data() + (size_t)c * frames;
+					short  r   = c < (int)route.size() ? route[c] : -1;
+					if (r >= 0 && r < info->channels) {
+						for (int i = 0; i < frames; i++)
+							dst[i] = load_sample(info->planes[r], i, info->out.format);
+					} else {
+						std::fill(dst, dst + frames, 0.0f);
+					}
+					planes[c] = dst;
+				}
+				lease.release();
+
+				meter.process(planes, frames);
+			}
+			// nothing measured yet, the meter is only configured by the first block
+			if (meter_rate)
+				publish();
+
+			// a quarter of the ring between passes leaves room for this thread to be held off for a while
+			int ring_ms = (int)(m * callback->block_frames * 1000 / std::max(callback->sample_rate, 1.0));
+			return std::max(ring_ms / 4, 5);
 		}
 	};
 
@@ -308,20 +789,153 @@ public:
 
 	~AudioCB()
 	{
+		delete _export;
+		delete _trace;
 		bfree(_name);
 	}
 
+	void request_ring_option(RingOption option, bool enable)
+	{
+		if (enable)
+			_ring_requests[option]++;
+		else
+			_ring_requests[option]--;
+	}
+
+	void request_jitter_buffer(bool enable)
+	{
+		if (enable)
+			_jitter_requests++;
+		else if (--_jitter_requests == 0)
+			_jitter_reset.store(true, std::memory_order_relaxed);
+	}
+
+	void request_delay(int frames, bool enable)
+	{
+		std::lock_guard<std::mutex> lock(_delay_mutex);
+		if (enable) {
+			_delays.insert(frames);
+		} else {
+			auto it = _delays.find(frames);
+			if (it != _delays.end())
+				_delays.erase(it);
+		}
+	}
+
+	// blocks needed to cover the mixer's reads plus the longest delay any listener serves from the ring
+	int ring_blocks(int buf_size)
+	{
+		int count = std::max(8, (AUDIO_OUTPUT_FRAMES * 2) / buf_size);
+		int delay = 0;
+		{
+			// an exported ring cannot grow while it is mapped, a longer delay lays it out again instead
+			std::lock_guard<std::mutex> lock(_delay_mutex);
+			if (!_delays.empty())
+				delay = *_delays.rbegin();
+		}
+		if (delay > 0) {
+			// round up so nudging the delay does not grow the ring every time
+			int capacity = buf_size;
+			while (capacity < delay)
+				capacity *= 2;
+			count += capacity / buf_size + 1;
+		}
+		return count;
+	}
+
+	// true when the requested ring options differ from the ones the ring was laid out with
+	bool needs_relayout()
+	{
+		for (int i = 0; i < RING_OPTIONS; i++) {
+			if ((_ring_requests[i].load() > 0) != _ring_applied[i])
+				return true;
+		}
+		return false;
+	}
+
+	// Makes room for a longer delay without restarting the device. Blocks keep their sequences, so a delayed
+	// listener carries on where it was. Returns false if the ring could not grow and has to be laid out again.
+	bool grow_ring()
+	{
+		int count = block_frames > 0 ? ring_blocks(block_frames) : 0;
+		if (count <= (int)_ring.size())
+			return true;
+		if (!_ring.grow(count))
+			return false;
+		blog(LOG_INFO, "Ring grown to %d blocks", count);
+		return true;
+	}
+
+	AsioTrace *trace()
+	{
+		return _trace;
+	}
+
+	// writes the recent callback timing to a trace file, which then shows up as a replay device
+	std::string dump_trace()
+	{
+		if (!_trace)
+			return "";
+		std::string path = _trace->dump(trace_folder());
+		if (!path.empty())
+			blog(LOG_INFO, "Wrote timing trace (%s)", path.c_str());
+		return path;
+	}
+
+	void restart()
+	{
+		if (_device && _device->isPlaying()) {
+			_device->stop();
+			_device->start(this);
+		}
+	}
+
 	void audioDeviceIOCallback(const float **inputChannelData, int numInputChannels, float **outputChannelData,
 			int numOutputChannels, int numSamples)
 	{
-		uint64_t ts = os_gettime_ns();
+		uint64_t ts      = os_gettime_ns();
+		uint64_t seq     = 0;
+		int      index   = 0;
+		uint64_t stamp   = ts;
+		uint64_t release = ts;
+
+		// the last request went since an earlier block, start the clock over once
+		if (_jitter_reset.load(std::memory_order_relaxed)) {
+			_jitter_reset.store(false, std::memory_order_relaxed);
+			_jitter.reset();
+		}
+		// scheduled before the overrun check so a dropped block still moves the clock on
+		if (_jitter_requests.load(std::memory_order_relaxed) > 0) {
+			uint64_t duration  = frames_to_ns(numSamples, (uint32_t)sample_rate);
+			uint64_t max_depth = frames_to_ns(std::max(AUDIO_OUTPUT_FRAMES, block_frames * 4),
+					(uint32_t)sample_rate);
+			_jitter.schedule(ts, duration, max_depth, stamp, release);
+		}
+
+		AsioRing::Slot *slot = _ring.begin_write(seq, index);
+		if (!slot) {
+			_overruns.fetch_add(1, std::memory_order_relaxed);
+			if (_trace)
+				_trace->record(ASIO_TRACE_OVERRUN, ts, seq, numSamples, (uint16_t)index);
+			last_audio_ts = ts;
+			return;
+		}
 
-		for (int i = 0; i < numInputChannels; i++)
-			buffers[_write_index].buffer.copyFrom(i, 0, inputChannelData[i], numSamples);
-		buffers[_write_index].out.timestamp       = ts;
-		buffers[_write_index].out.frames          = numSamples;
-		buffers[_write_index].out.samples_per_sec = (uint32_t)sample_rate;
-		_write_index                              = (_write_index + 1) % buffers.size();
+		if (_export)
+			_export->begin_write(index);
+		int channels = std::min(numInputChannels, slot->channels);
+		int frames   = std::min(numSamples, block_frames);
+		for (int i = 0; i < channels; i++)
+			convert_plane(inputChannelData[i], slot->planes[i], frames, slot->out.format);
+		slot->out.timestamp       = stamp;
+		slot->out.frames          = frames;
+		slot->out.samples_per_sec = (uint32_t)sample_rate;
+		slot->release             = release;
+		_ring.end_write(slot, seq);
+		if (_export)
+			_export->publish(index, seq, stamp, frames);
+		if (_trace)
+			_trace->record(ASIO_TRACE_CALLBACK, ts, seq, frames, (uint16_t)index);
 
 		last_audio_ts = ts;
 		UNUSED_PARAMETER(numOutputChannels);
@@ -334,7 +948,7 @@ public:
 			_thread = global_thread;
 
 		client->setCurrentCallback(this);
-		client->setReadIndex(_write_index);
+		client->setReadSequence(write_sequence());
 		_thread->addTimeSliceClient(client);
 	}
 
@@ -354,42 +968,56 @@ public:
 		juce::String name = device->getName();
 		sample_rate       = device->getCurrentSampleRate();
 		int buf_size      = device->getCurrentBufferSizeSamples();
-		int target_size   = AUDIO_OUTPUT_FRAMES * 2;
-		int count         = std::max(8, target_size / buf_size);
 		int ch_count      = device->getActiveInputChannels().countNumberOfSetBits();
 
-		if (buffers.size() < count)
-			buffers.reserve(count);
-		int i = 0;
-		for (; i < buffers.size(); i++) {
-			buffers[i].buffer              = AudioBuffer<float>(ch_count, buf_size);
-			buffers[i].out.format          = AUDIO_FORMAT_FLOAT_PLANAR;
-			buffers[i].out.samples_per_sec = sample_rate;
-		}
-		for (; i < count; i++) {
-			AudioBufferInfo inf;
-			inf.buffer              = AudioBuffer<float>(ch_count, buf_size);
-			inf.out.format          = AUDIO_FORMAT_FLOAT_PLANAR;
-			inf.out.samples_per_sec = sample_rate;
-			buffers.push_back(inf);
-		}
-		// cache the silent buffer at the device level
+		for (int o = 0; o < RING_OPTIONS; o++)
+			_ring_applied[o] = _ring_requests[o].load() > 0;
+		int count = ring_blocks(buf_size);
+
+		audio_format format = AUDIO_FORMAT_FLOAT_PLANAR;
+		if (_ring_applied[RING_NATIVE_FORMAT])
+			format = native_ring_format(device->getCurrentBitDepth());
+		block_frames = buf_size;
+
+		// listeners and the analyzer keep running through a restart, keep them out while the slots are rebuilt
+		_ring.close();
+		// while a source exports this device the ring lives in the shared segment instead
+		delete _export;
+		_export = nullptr;
+		if (_ring_applied[RING_EXPORT])
+			_export = AsioExport::create(
+					_name, format, (uint32_t)sample_rate, ch_count, buf_size, count);
+
+		_ring.layout(count, ch_count, buf_size, format, (uint32_t)sample_rate, _export);
+
+		// cache the silent buffer at the device level, listeners fill gaps from it once the ring opens
 		silent_ab      = AudioBuffer<float>(1, buf_size);
 		float *samples = silent_ab.getWritePointer(0);
 		for (size_t sample = 0; sample < buf_size; sample++) {
 			samples[sample] = 0.0f;
 		}
 
+		_ring.open();
+		_jitter.reset();
+		blog(LOG_INFO, "Ring of %d blocks, %d bytes per sample", (int)_ring.size(), bytedepth_format(format));
+
+		// about a minute of callbacks and deliveries at common buffer sizes
+		if (!_trace)
+			_trace = new AsioTrace(1 << 16);
+		_trace->set_format(_name, (uint32_t)sample_rate, buf_size, ch_count, device->getCurrentBitDepth());
+
 		if (!_thread) {
 			_thread = global_thread;
 		} else {
+			// the thread is shared by every device, a restart leaves other devices' listeners alone
 			for (int i = 0; i < _thread->getNumClients(); i++) {
 				AudioListener *l = static_cast<AudioListener *>(_thread->getClient(i));
-				l->setCurrentCallback(this);
+				if (l->getCallback() == this)
+					l->setCurrentCallback(this);
 			}
 		}
 		if (!_thread->isThreadRunning())
-			_thread->startThread(10);
+			_thread->start();
 	}
 
 	void audioDeviceStopped()
@@ -398,6 +1026,11 @@ public:
 
 		std::string timestamp_string = std::to_string(last_audio_ts);
 		blog(LOG_INFO, "Last Recieved Timestamp (%s)", timestamp_string.c_str());
+		blog(LOG_INFO, "Blocks dropped on leased slots (%llu)", (unsigned long long)overruns());
+		if (_jitter_requests.load() > 0)
+			blog(LOG_INFO, "Jitter buffer depth %.2f ms, callback jitter %.2f ms, %llu underruns",
+					_jitter.depth() / 1000000.0, _jitter.jitter() / 1000000.0,
+					(unsigned long long)_jitter.underruns());
 		last_audio_ts = 0;
 	}
 
@@ -407,9 +1040,15 @@ public:
 			_thread->stopThread(200);
 		std::string error = errorMessage.toStdString();
 		blog(LOG_ERROR, "Device Error!\n%s", error.c_str());
+		dump_trace();
 
 		std::string timestamp_string = std::to_string(last_audio_ts);
 		blog(LOG_INFO, "Last Recieved Timestamp (%s)", timestamp_string.c_str());
+		blog(LOG_INFO, "Blocks dropped on leased slots (%llu)", (unsigned long long)overruns());
+		if (_jitter_requests.load() > 0)
+			blog(LOG_INFO, "Jitter buffer depth %.2f ms, callback jitter %.2f ms, %llu underruns",
+					_jitter.depth() / 1000000.0, _jitter.jitter() / 1000000.0,
+					(unsigned long long)_jitter.underruns());
 		last_audio_ts = 0;
 	}
 };
@@ -418,10 +1057,113 @@ static bool show_panel(obs_properties_t *props, obs_property_t *property, void *
 
 class ASIOPlugin {
 private:
-	AudioIODevice          *_device   = nullptr;
-	AudioCB::AudioListener *_listener = nullptr;
-	std::vector<uint16_t>   _route;
-	speaker_layout          _speakers;
+	AudioIODevice             *_device   = nullptr;
+	AudioCB::AudioListener    *_listener = nullptr;
+	std::vector<uint16_t>      _route;
+	speaker_layout             _speakers;
+	AudioCB                   *_ring_cb[AudioCB::RING_OPTIONS] = {};
+	AudioCB                   *_delay_cb                       = nullptr;
+	int                        _delay_frames                   = 0;
+	AudioCB                   *_jitter_cb                      = nullptr;
+	AudioCB::LoudnessAnalyzer *_loudness                       = nullptr;
+
+	// moves this source's ring option requests to callback (or drops them when it is null), grows the ring of
+	// any device that now needs more blocks and restarts any device whose ring has to be laid out again
+	void update_ring_options(AudioCB *callback, obs_data_t *settings)
+	{
+		static const char *keys[AudioCB::RING_OPTIONS] = {"shm_export", "native_format"};
+		AudioCB           *touched[2]                  = {nullptr, nullptr};
+
+		for (int o = 0; o < AudioCB::RING_OPTIONS; o++) {
+			AudioCB::RingOption option = (AudioCB::RingOption)o;
+			AudioCB            *target = nullptr;
+			if (callback && settings && obs_data_get_bool(settings, keys[o]))
+				target = callback;
+			if (target == _ring_cb[o])
+				continue;
+			if (_ring_cb[o]) {
+				_ring_cb[o]->request_ring_option(option, false);
+				touched[0] = _ring_cb[o];
+			}
+			if (target) {
+				target->request_ring_option(option, true);
+				touched[1] = target;
+			}
+			_ring_cb[o] = target;
+		}
+
+		int      delay        = (callback && settings) ? (int)obs_data_get_int(settings, "delay_samples") : 0;
+		AudioCB *delay_target = delay > 0 ? callback : nullptr;
+		if (delay_target != _delay_cb || delay != _delay_frames) {
+			if (_delay_cb) {
+				_delay_cb->request_delay(_delay_frames, false);
+				touched[0] = _delay_cb;
+			}
+			if (delay_target) {
+				delay_target->request_delay(delay, true);
+				touched[1] = delay_target;
+			}
+			_delay_cb     = delay_target;
+			_delay_frames = delay_target ? delay : 0;
+		}
+
+		// the jitter buffer only changes how blocks are stamped, no restart needed
+		AudioCB *jitter_target = nullptr;
+		if (callback && settings && obs_data_get_bool(settings, "jitter_buffer"))
+			jitter_target = callback;
+		if (jitter_target != _jitter_cb) {
+			if (_jitter_cb)
+				_jitter_cb->request_jitter_buffer(false);
+			if (jitter_target)
+				jitter_target->request_jitter_buffer(true);
+			_jitter_cb = jitter_target;
+		}
+
+		for (int i = 0; i < 2; i++) {
+			if (!touched[i] || (i == 1 && touched[1] == touched[0]))
+				continue;
+			if (touched[i]->needs_relayout() || !touched[i]->grow_ring())
+				touched[i]->restart();
+		}
+	}
+
+	// attaches the loudness analyzer to callback's ring when the source asks for it, detaches it otherwise
+	void update_loudness(AudioCB *callback, obs_data_t *settings)
+	{
+		AudioCB *target = nullptr;
+		if (callback && settings && obs_data_get_bool(settings, "loudness"))
+			target = callback;
+		if (target == _loudness->getCallback())
+			return;
+		// returns once the analysis thread is out of the analyzer
+		analysis_thread->removeTimeSliceClient(_loudness);
+		if (_loudness->missed())
+			blog(LOG_INFO, "Loudness measurement missed %llu blocks",
+					(unsigned long long)_loudness->missed());
+		_loudness->setCallback(target);
+		if (target)
+			analysis_thread->addTimeSliceClient(_loudness);
+	}
+
+	static void get_loudness(void *data, calldata_t *cd)
+	{
+		ASIOPlugin                *plugin = static_cast<ASIOPlugin *>(data);
+		AudioCB::LoudnessAnalyzer *l      = plugin->_loudness;
+		float                      peak   = -INFINITY;
+		for (int c = 0; c < MAX_AV_PLANES; c++)
+			peak = std::max(peak, l->true_peak(c));
+		calldata_set_float(cd, "momentary", l->momentary());
+		calldata_set_float(cd, "short_term", l->short_term());
+		calldata_set_float(cd, "integrated", l->integrated());
+		calldata_set_float(cd, "true_peak", peak);
+		calldata_set_int(cd, "missed", (long long)l->missed());
+	}
+
+	static void reset_loudness_proc(void *data, calldata_t *cd)
+	{
+		UNUSED_PARAMETER(cd);
+		static_cast<ASIOPlugin *>(data)->_loudness->reset();
+	}
 
 public:
 	AudioIODevice *getDevice()
@@ -433,10 +1175,24 @@ public:
 	{
 		UNUSED_PARAMETER(settings);
 		_listener = new AudioCB::AudioListener(source, nullptr);
+		_loudness = new AudioCB::LoudnessAnalyzer();
+
+		// for scripts and other plugins polling the measurement
+		proc_handler_t *ph = obs_source_get_proc_handler(source);
+		proc_handler_add(ph,
+				"void get_loudness(out float momentary, out float short_term, out float integrated, "
+				"out float true_peak, out int missed)",
+				get_loudness, this);
+		proc_handler_add(ph, "void reset_loudness()", reset_loudness_proc, this);
 	}
 
 	~ASIOPlugin()
 	{
+		global_thread->drop_scheduling(this);
+		update_ring_options(nullptr, nullptr);
+		update_loudness(nullptr, nullptr);
+		delete _loudness;
+		_loudness = nullptr;
 		if (_listener) {
 			AudioCB *cb = _listener->getCallback();
 			_listener->disconnect();
@@ -480,6 +1236,27 @@ public:
 		return true;
 	}
 
+	static bool dump_trace(obs_properties_t *props, obs_property_t *property, void *data)
+	{
+		UNUSED_PARAMETER(props);
+		UNUSED_PARAMETER(property);
+		ASIOPlugin *plugin = static_cast<ASIOPlugin *>(data);
+		AudioCB    *cb     = plugin ? plugin->_listener->getCallback() : nullptr;
+		if (cb)
+			cb->dump_trace();
+		return false;
+	}
+
+	static bool reset_loudness(obs_properties_t *props, obs_property_t *property, void *data)
+	{
+		UNUSED_PARAMETER(props);
+		UNUSED_PARAMETER(property);
+		ASIOPlugin *plugin = static_cast<ASIOPlugin *>(data);
+		if (plugin)
+			plugin->_loudness->reset();
+		return false;
+	}
+
 	static obs_properties_t *Properties(void *vptr)
 	{
 		UNUSED_PARAMETER(vptr);
@@ -488,6 +1265,16 @@ public:
 		obs_property_t               *format;
 		obs_property_t               *panel;
 		obs_property_t               *button;
+		obs_property_t               *shm_export;
+		obs_property_t               *native_format;
+		obs_property_t               *delay;
+		obs_property_t               *trace;
+		obs_property_t               *priority;
+		obs_property_t               *cpu;
+		obs_property_t               *jitter;
+		obs_property_t               *loudness;
+		obs_properties_t             *dsp;
+		obs_property_t               *prop;
 		int                           max_channels = get_max_obs_channels();
 		std::vector<obs_property_t *> route(max_channels, nullptr);
 
@@ -512,6 +1299,64 @@ public:
 					route[i], obs_module_text(("Route.Desc." + std::to_string(i)).c_str()));
 		}
 
+		delay = obs_properties_add_int(
+				props, "delay_samples", obs_module_text("Delay"), 0, MAX_DELAY_FRAMES, 1);
+		obs_property_set_long_description(delay, obs_module_text("Delay.Desc"));
+
+		dsp = obs_properties_create();
+		// one gain per OBS channel, shown for the same channels as the routes
+		for (size_t i = 0; i < max_channels; i++) {
+			prop = obs_properties_add_float_slider(dsp, ("dsp_gain " + std::to_string(i)).c_str(),
+					obs_module_text(("Dsp.Gain." + std::to_string(i)).c_str()), -30.0, 30.0, 0.1);
+			obs_property_float_set_suffix(prop, " dB");
+		}
+		prop = obs_properties_add_int(dsp, "dsp_hpf", obs_module_text("Dsp.HighPass"), 0, 500, 1);
+		obs_property_int_set_suffix(prop, " Hz");
+		obs_property_set_long_description(prop, obs_module_text("Dsp.HighPass.Desc"));
+		obs_properties_add_bool(dsp, "dsp_gate", obs_module_text("Dsp.Gate"));
+		prop = obs_properties_add_float_slider(
+				dsp, "dsp_gate_open", obs_module_text("Dsp.Gate.Open"), -96.0, 0.0, 0.1);
+		obs_property_float_set_suffix(prop, " dB");
+		prop = obs_properties_add_float_slider(
+				dsp, "dsp_gate_close", obs_module_text("Dsp.Gate.Close"), -96.0, 0.0, 0.1);
+		obs_property_float_set_suffix(prop, " dB");
+		prop = obs_properties_add_int(dsp, "dsp_gate_attack", obs_module_text("Dsp.Gate.Attack"), 0, 10000, 1);
+		obs_property_int_set_suffix(prop, " ms");
+		prop = obs_properties_add_int(dsp, "dsp_gate_hold", obs_module_text("Dsp.Gate.Hold"), 0, 10000, 1);
+		obs_property_int_set_suffix(prop, " ms");
+		prop = obs_properties_add_int(
+				dsp, "dsp_gate_release", obs_module_text("Dsp.Gate.Release"), 0, 10000, 1);
+		obs_property_int_set_suffix(prop, " ms");
+		obs_properties_add_group(props, "dsp_enable", obs_module_text("Dsp"), OBS_GROUP_CHECKABLE, dsp);
+
+		shm_export = obs_properties_add_bool(props, "shm_export", obs_module_text("ShmExport"));
+		obs_property_set_long_description(shm_export, obs_module_text("ShmExport.Desc"));
+		native_format = obs_properties_add_bool(props, "native_format", obs_module_text("NativeFormat"));
+		obs_property_set_long_description(native_format, obs_module_text("NativeFormat.Desc"));
+
+		priority = obs_properties_add_list(props, "dispatcher_priority", obs_module_text("Dispatcher.Priority"),
+				OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+		obs_property_list_add_int(priority, obs_module_text("Dispatcher.Priority.Normal"), 5);
+		obs_property_list_add_int(priority, obs_module_text("Dispatcher.Priority.High"), 8);
+		obs_property_list_add_int(priority, obs_module_text("Dispatcher.Priority.Highest"), 10);
+		obs_property_list_add_int(priority, obs_module_text("Dispatcher.Priority.Realtime"), 11);
+		obs_property_set_long_description(priority, obs_module_text("Dispatcher.Priority.Desc"));
+		cpu = obs_properties_add_int(props, "dispatcher_cpu", obs_module_text("Dispatcher.Cpu"), -1, 31, 1);
+		obs_property_set_long_description(cpu, obs_module_text("Dispatcher.Cpu.Desc"));
+		// the delivery thread follows the strongest request across sources, which may not be this one's
+		dispatcher_scheduling running = global_thread->current_scheduling();
+		const char           *level   = "Dispatcher.Priority.Normal";
+		if (running.realtime)
+			level = "Dispatcher.Priority.Realtime";
+		else if (running.priority >= 10)
+			level = "Dispatcher.Priority.Highest";
+		else if (running.priority >= 8)
+			level = "Dispatcher.Priority.High";
+		char in_effect[256];
+		snprintf(in_effect, sizeof(in_effect), "%s: %s, %s %d", obs_module_text("Dispatcher.InEffect"),
+				obs_module_text(level), obs_module_text("Dispatcher.Cpu"), running.cpu);
+		obs_properties_add_text(props, "dispatcher_in_effect", in_effect, OBS_TEXT_INFO);
+
 		panel = obs_properties_add_button2(props, "ctrl", obs_module_text("Control Panel"), show_panel, vptr);
 		ASIOPlugin    *plugin = static_cast<ASIOPlugin *>(vptr);
 		AudioIODevice *device = nullptr;
@@ -519,6 +1364,42 @@ public:
 			device = plugin->getDevice();
 
 		obs_property_set_visible(panel, device && device->hasControlPanel());
+
+		jitter = obs_properties_add_bool(props, "jitter_buffer", obs_module_text("JitterBuffer"));
+		obs_property_set_long_description(jitter, obs_module_text("JitterBuffer.Desc"));
+		if (plugin && plugin->_jitter_cb) {
+			const JitterBuffer &jb = plugin->_jitter_cb->jitter();
+			char                stats[256];
+			snprintf(stats, sizeof(stats), "%s: %.1f ms, %s: %.2f ms, %s: %llu",
+					obs_module_text("JitterBuffer.Depth"), jb.depth() / 1000000.0,
+					obs_module_text("JitterBuffer.Jitter"), jb.jitter() / 1000000.0,
+					obs_module_text("JitterBuffer.Underruns"), (unsigned long long)jb.underruns());
+			obs_properties_add_text(props, "jitter_stats", stats, OBS_TEXT_INFO);
+		}
+
+		loudness = obs_properties_add_bool(props, "loudness", obs_module_text("Loudness"));
+		obs_property_set_long_description(loudness, obs_module_text("Loudness.Desc"));
+		if (plugin && plugin->_loudness->getCallback()) {
+			AudioCB::LoudnessAnalyzer *l      = plugin->_loudness;
+			float                      peak   = -INFINITY;
+			uint64_t                   missed = l->missed();
+			char                       stats[256];
+			for (int c = 0; c < MAX_AV_PLANES; c++)
+				peak = std::max(peak, l->true_peak(c));
+			int len = snprintf(stats, sizeof(stats), "M %.1f, S %.1f, I %.1f LUFS, %s %.1f dBTP",
+					l->momentary(), l->short_term(), l->integrated(),
+					obs_module_text("Loudness.TruePeak"), peak);
+			// the driver got ahead of the analysis thread, the measurement has holes
+			if (missed && len > 0 && len < (int)sizeof(stats))
+				snprintf(stats + len, sizeof(stats) - len, ", %llu %s", (unsigned long long)missed,
+						obs_module_text("Loudness.Missed"));
+			obs_properties_add_text(props, "loudness_stats", stats, OBS_TEXT_INFO);
+			obs_properties_add_button2(props, "loudness_reset", obs_module_text("Loudness.Reset"),
+					reset_loudness, vptr);
+		}
+
+		trace = obs_properties_add_button2(props, "dump_trace", obs_module_text("DumpTrace"), dump_trace, vptr);
+		obs_property_set_long_description(trace, obs_module_text("DumpTrace.Desc"));
 		button = obs_properties_add_button(props, "credits", "CREDITS", credits);
 		return props;
 	}
@@ -529,6 +1410,12 @@ public:
 		speaker_layout layout   = (speaker_layout)obs_data_get_int(settings, "speaker_layout");
 		AudioCB       *callback = nullptr;
 
+		// one dispatcher serves every source, it runs with the strongest scheduling any of them asks for
+		int                   priority   = (int)obs_data_get_int(settings, "dispatcher_priority");
+		dispatcher_scheduling scheduling = {std::min(priority, 10), priority > 10,
+				(int)obs_data_get_int(settings, "dispatcher_cpu")};
+		global_thread->request_scheduling(this, scheduling);
+
 		AudioIODevice *selected_device = nullptr;
 		for (int i = 0; i < callbacks.size(); i++) {
 			AudioCB       *cb     = callbacks[i];
@@ -536,8 +1423,7 @@ public:
 			std::string    n      = cb->getName();
 			if (n == name) {
 				if (!device) {
-					String deviceName = name.c_str();
-					device            = deviceTypeAsio->createDevice(deviceName, deviceName);
+					device = create_device(name);
 					cb->setDevice(device, name.c_str());
 				}
 				selected_device = device;
@@ -555,6 +1441,8 @@ public:
 
 			if (cb)
 				cb->remove_client(_listener);
+			update_ring_options(nullptr, nullptr);
+			update_loudness(nullptr, nullptr);
 			return;
 		}
 
@@ -579,12 +1467,15 @@ public:
 
 				if (cb)
 					cb->remove_client(_listener);
+				update_ring_options(nullptr, nullptr);
+				update_loudness(nullptr, nullptr);
 				return;
 			}
 		}
 
 		AudioCB *cb = _listener->getCallback();
 		_listener->setCurrentCallback(callback);
+		update_ring_options(callback, settings);
 
 		if (_device->isOpen() && !_device->isPlaying() && callback)
 			_device->start(callback);
@@ -610,6 +1501,23 @@ public:
 			}
 
 			_listener->setRoute(r);
+			_loudness->setRoute(r, layout);
+			update_loudness(callback, settings);
+			_listener->setDelay(obs_data_get_int(settings, "delay_samples"));
+
+			asio_dsp_params dsp;
+			for (int i = 0; i < MAX_AV_PLANES; i++) {
+				std::string gain_str = "dsp_gain " + std::to_string(i);
+				dsp.gain_db[i]       = (float)obs_data_get_double(settings, gain_str.c_str());
+			}
+			dsp.hpf_hz          = (float)obs_data_get_int(settings, "dsp_hpf");
+			dsp.gate            = obs_data_get_bool(settings, "dsp_gate");
+			dsp.gate_open_db    = (float)obs_data_get_double(settings, "dsp_gate_open");
+			dsp.gate_close_db   = (float)obs_data_get_double(settings, "dsp_gate_close");
+			dsp.gate_attack_ms  = (float)obs_data_get_int(settings, "dsp_gate_attack");
+			dsp.gate_hold_ms    = (float)obs_data_get_int(settings, "dsp_gate_hold");
+			dsp.gate_release_ms = (float)obs_data_get_int(settings, "dsp_gate_release");
+			_listener->setDsp(obs_data_get_bool(settings, "dsp_enable"), dsp);
 
 			obs_source_audio out;
 			out.speakers = layout;
@@ -624,6 +1532,7 @@ public:
 			_listener->disconnect();
 			if (cb)
 				cb->remove_client(_listener);
+			update_loudness(nullptr, nullptr);
 		}
 	}
 
@@ -651,6 +1560,25 @@ public:
 		}
 
 		obs_data_set_default_int(settings, "speaker_layout", aoi.speakers);
+		obs_data_set_default_bool(settings, "jitter_buffer", false);
+		obs_data_set_default_bool(settings, "loudness", false);
+		obs_data_set_default_bool(settings, "shm_export", false);
+		obs_data_set_default_bool(settings, "native_format", false);
+		obs_data_set_default_int(settings, "delay_samples", 0);
+		obs_data_set_default_bool(settings, "dsp_enable", false);
+		for (int i = 0; i < max_channels; i++) {
+			std::string name = "dsp_gain " + std::to_string(i);
+			obs_data_set_default_double(settings, name.c_str(), 0.0);
+		}
+		obs_data_set_default_int(settings, "dsp_hpf", 0);
+		obs_data_set_default_bool(settings, "dsp_gate", false);
+		obs_data_set_default_double(settings, "dsp_gate_open", -26.0);
+		obs_data_set_default_double(settings, "dsp_gate_close", -32.0);
+		obs_data_set_default_int(settings, "dsp_gate_attack", 25);
+		obs_data_set_default_int(settings, "dsp_gate_hold", 200);
+		obs_data_set_default_int(settings, "dsp_gate_release", 150);
+		obs_data_set_default_int(settings, "dispatcher_priority", 10);
+		obs_data_set_default_int(settings, "dispatcher_cpu", -1);
 	}
 
 	static const char *Name(void *unused)
@@ -687,8 +1615,7 @@ static bool fill_out_channels_modified(obs_properties_t *props, obs_property_t *
 		std::string    n      = cb->getName();
 		if (n == name) {
 			if (!device) {
-				String deviceName = name.c_str();
-				device            = deviceTypeAsio->createDevice(deviceName, deviceName);
+				device = create_device(name);
 				cb->setDevice(device, name.c_str());
 			}
 			_device   = device;
@@ -745,6 +1672,8 @@ static bool asio_device_changed(void *vptr, obs_properties_t *props, obs_propert
 			obs_property_set_modified_callback(r, fill_out_channels_modified);
 			obs_property_set_visible(r, i < recorded_channels);
 			fill_out_channels_modified(props, r, settings);
+			std::string gain = "dsp_gain " + std::to_string(i);
+			obs_property_set_visible(obs_properties_get(props, gain.c_str()), i < recorded_channels);
 		}
 	}
 
@@ -770,30 +1699,37 @@ static bool asio_layout_changed(obs_properties_t *props, obs_property_t *list, o
 		obs_property_set_modified_callback(r, fill_out_channels_modified);
 		obs_property_set_visible(r, i < recorded_channels);
 		fill_out_channels_modified(props, r, settings);
+		std::string gain = "dsp_gain " + std::to_string(i);
+		obs_property_set_visible(obs_properties_get(props, gain.c_str()), i < recorded_channels);
 	}
 	return true;
 }
 
-static void fill_out_devices(obs_property_t *prop)
+static void add_device_callbacks(const std::vector<std::string> &names)
 {
-	StringArray deviceNames(deviceTypeAsio->getDeviceNames());
-	for (int j = 0; j < deviceNames.size(); j++) {
+	for (size_t j = 0; j < names.size(); j++) {
 		bool found = false;
 		for (int i = 0; i < callbacks.size(); i++) {
 			AudioCB    *cb = callbacks[i];
 			std::string n  = cb->getName();
-			if (deviceNames[j].toStdString() == n) {
+			if (names[j] == n) {
 				found = true;
 				break;
 			}
 		}
-		if (!found) {
-			char    *name = bstrdup(deviceNames[j].toStdString().c_str());
-			AudioCB *cb   = new AudioCB(nullptr, name);
-			bfree(name);
-			callbacks.push_back(cb);
-		}
+		if (!found)
+			callbacks.push_back(new AudioCB(nullptr, names[j].c_str()));
 	}
+}
+
+static void fill_out_devices(obs_property_t *prop)
+{
+	StringArray              deviceNames(deviceTypeAsio->getDeviceNames());
+	std::vector<std::string> names;
+	for (int j = 0; j < deviceNames.size(); j++)
+		names.push_back(deviceNames[j].toStdString());
+	add_device_callbacks(names);
+	add_device_callbacks(trace_device_names());
 
 	obs_property_list_clear(prop);
 
@@ -810,7 +1746,9 @@ bool obs_module_load(void)
 	obs_get_audio_info(&aoi);
 
 	MessageManager::getInstance();
-	global_thread = new TimeSliceThread("global");
+	global_thread   = new DispatcherThread("global");
+	analysis_thread = new TimeSliceThread("loudness");
+	analysis_thread->startThread(3);
 	deviceTypeAsio->scanForDevices();
 	StringArray deviceNames(deviceTypeAsio->getDeviceNames());
 
@@ -823,6 +1761,7 @@ bool obs_module_load(void)
 		bfree(name);
 		callbacks.push_back(cb);
 	}
+	add_device_callbacks(trace_device_names());
 
 	struct obs_source_info asio_input_capture = {};
 	asio_input_capture.id                     = "asio_input_capture";
@@ -862,4 +1801,6 @@ void obs_module_unload(void)
 	if (!global_thread->stopThread(200))
 		blog(LOG_ERROR, "win-asio: Thread had to be force-stopped");
 	delete global_thread;
+	analysis_thread->stopThread(1000);
+	delete analysis_thread;
 }
@@ -0,0 +1,73 @@
+/*
+Copyright (C) 2019 by andersama <anderson.john.alexander@gmail.com>
+and pkv <pkv.stream@gmail.com>.
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "asio-jitter.h"
+
+#include <algorithm>
+#include <cmath>
+
+void JitterBuffer::reset()
+{
+	next     = 0;
+	last     = 0;
+	mean     = 0.0;
+	variance = 0.0;
+	peak     = 0;
+	_depth.store(0, std::memory_order_relaxed);
+	_jitter.store(0, std::memory_order_relaxed);
+	_underruns.store(0, std::memory_order_relaxed);
+}
+
+void JitterBuffer::schedule(uint64_t arrival, uint64_t duration, uint64_t max_depth, uint64_t &timestamp,
+		uint64_t &release)
+{
+	// first block, or the driver stalled or jumped by more than the ring could ever smooth over
+	int64_t late = (int64_t)(arrival - next);
+	if (!next || late > (int64_t)(8 * duration) || late < -(int64_t)(8 * duration)) {
+		next = arrival;
+		last = 0;
+		late = 0;
+	}
+
+	if (last) {
+		double interval = (double)(arrival - last);
+		mean += (interval - mean) / 64.0;
+		variance += ((interval - mean) * (interval - mean) - variance) / 64.0;
+		_jitter.store((uint64_t)std::sqrt(variance), std::memory_order_relaxed);
+	}
+	last = arrival;
+
+	// a block arriving after its release time left the listeners with nothing to deliver
+	uint64_t depth = _depth.load(std::memory_order_relaxed);
+	if (late > 0 && (uint64_t)late > depth)
+		_underruns.fetch_add(1, std::memory_order_relaxed);
+
+	// jump up to a new worst case at once, forget it over about a thousand blocks
+	if (late > 0 && (uint64_t)late > peak)
+		peak = (uint64_t)late;
+	else
+		peak -= peak >> 10;
+
+	// a quarter on top of the worst case seen. The inter-arrival spread overstates it for bursty drivers, whose
+	// blocks land on both sides of the clock, so it is only reported.
+	depth = std::min(peak + peak / 4, max_depth);
+	_depth.store(depth, std::memory_order_relaxed);
+
+	timestamp = next;
+	release   = next + depth;
+
+	// pull the clock slowly toward the arrivals so it follows the driver's real rate
+	next += duration + late / 64;
+}
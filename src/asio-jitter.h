@@ -0,0 +1,63 @@
+/*
+Copyright (C) 2019 by andersama <anderson.john.alexander@gmail.com>
+and pkv <pkv.stream@gmail.com>.
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+// Smooths bursty driver callbacks. Every block is stamped on a steady clock fitted to the callback arrivals and
+// released to listeners a fixed depth behind that clock. The depth follows the latest any recent block arrived
+// against the clock, so it stays at the minimum that keeps every block in the ring before its release time.
+class JitterBuffer {
+private:
+	// driver thread only
+	uint64_t next     = 0; // clock time of the next block, 0 until the first one arrives
+	uint64_t last     = 0; // arrival of the previous block
+	double   mean     = 0.0;
+	double   variance = 0.0;
+	uint64_t peak     = 0; // decaying peak of how late blocks arrived against the clock
+
+	std::atomic<uint64_t> _depth     = {0};
+	std::atomic<uint64_t> _jitter    = {0};
+	std::atomic<uint64_t> _underruns = {0};
+
+public:
+	// forgets the clock and the statistics, called from the driver thread or while it is stopped
+	void reset();
+
+	// driver thread: arrival is when the callback ran, duration how long the block plays and max_depth how far
+	// behind the clock the ring can afford to hold blocks. Returns the block's timestamp and release time.
+	void schedule(uint64_t arrival, uint64_t duration, uint64_t max_depth, uint64_t &timestamp,
+			uint64_t &release);
+
+	// current release depth in ns
+	uint64_t depth() const
+	{
+		return _depth.load(std::memory_order_relaxed);
+	}
+
+	// standard deviation of the callback inter-arrival time in ns
+	uint64_t jitter() const
+	{
+		return _jitter.load(std::memory_order_relaxed);
+	}
+
+	// blocks that arrived after their release time, listeners ran dry waiting for them
+	uint64_t underruns() const
+	{
+		return _underruns.load(std::memory_order_relaxed);
+	}
+};
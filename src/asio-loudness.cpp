@@ -0,0 +1,256 @@
+/*
+Copyright (C) 2019 by andersama <anderson.john.alexander@gmail.com>
+and pkv <pkv.stream@gmail.com>.
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "asio-loudness.h"
+#include "asio-simd.h"
+
+static const double pi = 3.14159265358979323846;
+
+static inline float energy_to_lufs(double energy)
+{
+	return energy > 0.0 ? (float)(-0.691 + 10.0 * log10(energy)) : -INFINITY;
+}
+
+void LoudnessMeter::configure(uint32_t sample_rate, enum speaker_layout speakers)
+{
+	double rate = (double)std::max(sample_rate, 1u);
+
+	// channels in obs order: FL FR FC LFE RL RR SL SR, with 4.0 and 4.1 carrying a single rear centre last
+	channels = std::min((int)get_audio_channels(speakers), MAX_AV_PLANES);
+	for (int c = 0; c < MAX_AV_PLANES; c++)
+		weight[c] = c < channels ? 1.0f : 0.0f;
+	switch (speakers) {
+	case SPEAKERS_2POINT1:
+		weight[2] = 0.0f;
+		break;
+	case SPEAKERS_4POINT0:
+		weight[3] = 1.41f;
+		break;
+	case SPEAKERS_4POINT1:
+		weight[3] = 0.0f;
+		weight[4] = 1.41f;
+		break;
+	case SPEAKERS_5POINT1:
+	case SPEAKERS_7POINT1:
+		weight[3] = 0.0f;
+		for (int c = 4; c < channels; c++)
+			weight[c] = 1.41f;
+		break;
+	default:
+		break;
+	}
+
+	// BS.1770 pre-filter (head shelf) and RLB high-pass, derived for the actual sample rate
+	double K  = tan(pi * 1681.974450955533 / rate);
+	double Q  = 0.7071752369554196;
+	double Vh = pow(10.0, 3.999843853973347 / 20.0);
+	double Vb = pow(Vh, 0.4996667741545416);
+	double a0 = 1.0 + K / Q + K * K;
+	sb0       = (float)((Vh + Vb * K / Q + K * K) / a0);
+	sb1       = (float)(2.0 * (K * K - Vh) / a0);
+	sb2       = (float)((Vh - Vb * K / Q + K * K) / a0);
+	sa1       = (float)(2.0 * (K * K - 1.0) / a0);
+	sa2       = (float)((1.0 - K / Q + K * K) / a0);
+
+	K   = tan(pi * 38.13547087602444 / rate);
+	Q   = 0.5003270373238773;
+	a0  = 1.0 + K / Q + K * K;
+	hb0 = 1.0f;
+	hb1 = -2.0f;
+	hb2 = 1.0f;
+	ha1 = (float)(2.0 * (K * K - 1.0) / a0);
+	ha2 = (float)((1.0 - K / Q + K * K) / a0);
+
+	// 48 tap windowed sinc interpolator, each phase normalised to unity gain
+	for (int p = 0; p < 4; p++) {
+		double sum = 0.0;
+		for (int t = 0; t < tp_taps; t++) {
+			int    k    = p + 4 * t;
+			double x    = (k - (4 * tp_taps - 1) / 2.0) / 4.0;
+			double sinc = x == 0.0 ? 1.0 : sin(pi * x) / (pi * x);
+			double w    = 0.42 - 0.5 * cos(2.0 * pi * (k + 0.5) / (4 * tp_taps)) +
+				   0.08 * cos(4.0 * pi * (k + 0.5) / (4 * tp_taps));
+			tp_coef[p][t] = (float)(sinc * w);
+			sum += sinc * w;
+		}
+		for (int t = 0; t < tp_taps; t++)
+			tp_coef[p][t] = (float)(tp_coef[p][t] / sum);
+	}
+
+	memset(z, 0, sizeof(z));
+	memset(tp_hist, 0, sizeof(tp_hist));
+	tp_pos      = 0;
+	step_frames = (uint32_t)(rate / 10.0);
+	step_pos    = 0;
+	step_energy = 0.0;
+	memset(steps, 0, sizeof(steps));
+	step_count = 0;
+	reset();
+}
+
+void LoudnessMeter::reset()
+{
+	memset(tp_peak, 0, sizeof(tp_peak));
+	memset(gate_count, 0, sizeof(gate_count));
+	memset(gate_energy, 0, sizeof(gate_energy));
+}
+
+void LoudnessMeter::process(const float *const *in, int frames)
+{
+	if (!step_frames)
+		return;
+	int offset = 0;
+	while (offset < frames) {
+		int n = std::min(frames - offset, (int)(step_frames - step_pos));
+		process_chunk(in, offset, n);
+		offset += n;
+		step_pos += n;
+		if (step_pos == step_frames)
+			end_step();
+	}
+}
+
+void LoudnessMeter::process_chunk(const float *const *in, int offset, int frames)
+{
+#ifdef ASIO_SSE2
+	unsigned int csr = _mm_getcsr();
+	_mm_setcsr(csr | 0x8040);
+#endif
+	int pos = tp_pos;
+	for (int base = 0; base < channels; base += 4) {
+		int lanes = std::min(channels - base, 4);
+		v4  s1    = v4_load(z[0] + base);
+		v4  s2    = v4_load(z[1] + base);
+		v4  h1    = v4_load(z[2] + base);
+		v4  h2    = v4_load(z[3] + base);
+		v4  peak  = v4_load(tp_peak + base);
+		v4  acc   = v4_set(0.0f);
+
+		pos = tp_pos;
+		for (int i = 0; i < frames; i++) {
+			float lane[4] = {};
+			for (int l = 0; l < lanes; l++)
+				lane[l] = in[base + l][offset + i];
+			v4 x = v4_load(lane);
+
+			// true peak of the unweighted signal, between the samples as well as on them
+			v4_store(tp_hist[pos] + base, x);
+			v4_store(tp_hist[pos + tp_taps] + base, x);
+			for (int p = 0; p < 4; p++) {
+				v4 y = v4_set(0.0f);
+				for (int t = 0; t < tp_taps; t++)
+					y = y + v4_set(tp_coef[p][t]) * v4_load(tp_hist[pos + tp_taps - t] + base);
+				peak = v4_max(peak, v4_abs(y));
+			}
+			pos = pos + 1 == tp_taps ? 0 : pos + 1;
+
+			// K-weighting, both stages in transposed direct form II
+			v4 y = v4_set(sb0) * x + s1;
+			s1   = v4_set(sb1) * x - v4_set(sa1) * y + s2;
+			s2   = v4_set(sb2) * x - v4_set(sa2) * y;
+			x    = y;
+			y    = v4_set(hb0) * x + h1;
+			h1   = v4_set(hb1) * x - v4_set(ha1) * y + h2;
+			h2   = v4_set(hb2) * x - v4_set(ha2) * y;
+			acc  = acc + y * y;
+		}
+
+		float state[4];
+		v4_store(state, s1);
+		std::copy(state, state + lanes, z[0] + base);
+		v4_store(state, s2);
+		std::copy(state, state + lanes, z[1] + base);
+		v4_store(state, h1);
+		std::copy(state, state + lanes, z[2] + base);
+		v4_store(state, h2);
+		std::copy(state, state + lanes, z[3] + base);
+		v4_store(state, peak);
+		std::copy(state, state + lanes, tp_peak + base);
+		v4_store(state, acc * v4_load(weight + base));
+		for (int l = 0; l < lanes; l++)
+			step_energy += state[l];
+	}
+	tp_pos = pos;
+#ifdef ASIO_SSE2
+	_mm_setcsr(csr);
+#endif
+}
+
+void LoudnessMeter::end_step()
+{
+	steps[step_count % steps_kept] = step_energy / step_frames;
+	step_count++;
+	step_pos    = 0;
+	step_energy = 0.0;
+
+	// gating blocks are 400ms long and overlap by 75%, so one ends with every step
+	if (step_count < 4)
+		return;
+	double energy   = window_energy(4);
+	float  loudness = energy_to_lufs(energy);
+	if (!(loudness >= -70.0f))
+		return;
+	int bin = std::min((int)((loudness + 70.0f) * 10.0f), gate_bins - 1);
+	gate_count[bin]++;
+	gate_energy[bin] += energy;
+}
+
+double LoudnessMeter::window_energy(int n) const
+{
+	double sum = 0.0;
+	for (int i = 1; i <= n; i++)
+		sum += steps[(step_count - i) % steps_kept];
+	return sum / n;
+}
+
+float LoudnessMeter::momentary() const
+{
+	return step_count >= 4 ? energy_to_lufs(window_energy(4)) : -INFINITY;
+}
+
+float LoudnessMeter::short_term() const
+{
+	return step_count >= steps_kept ? energy_to_lufs(window_energy(steps_kept)) : -INFINITY;
+}
+
+float LoudnessMeter::integrated() const
+{
+	uint64_t count  = 0;
+	double   energy = 0.0;
+	for (int b = 0; b < gate_bins; b++) {
+		count += gate_count[b];
+		energy += gate_energy[b];
+	}
+	if (!count)
+		return -INFINITY;
+
+	// relative gate 10 LU under the loudness of everything above the absolute gate
+	float relative = energy_to_lufs(energy / count) - 10.0f;
+	int   first    = std::max((int)((relative + 70.0f) * 10.0f), 0);
+	count          = 0;
+	energy         = 0.0;
+	for (int b = first; b < gate_bins; b++) {
+		count += gate_count[b];
+		energy += gate_energy[b];
+	}
+	return count ? energy_to_lufs(energy / count) : -INFINITY;
+}
+
+float LoudnessMeter::true_peak(int channel) const
+{
+	if (channel < 0 || channel >= channels || tp_peak[channel] <= 0.0f)
+		return -INFINITY;
+	return 20.0f * log10f(tp_peak[channel]);
+}
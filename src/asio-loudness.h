@@ -0,0 +1,81 @@
+/*
+Copyright (C) 2019 by andersama <anderson.john.alexander@gmail.com>
+and pkv <pkv.stream@gmail.com>.
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <obs-module.h>
+#include <stdint.h>
+
+// EBU R128 loudness (ITU-R BS.1770-4) and 4x oversampled true peak of up to MAX_AV_PLANES channels. Channels are
+// processed four at a time, one per SIMD lane, through the K-weighting filters and the true peak interpolator in a
+// single pass.
+class LoudnessMeter {
+private:
+	static const int steps_kept = 30;  // 100ms steps, enough for the 3s short-term window
+	static const int tp_taps    = 12;  // taps per phase of the 4x interpolator
+	static const int gate_bins  = 800; // 0.1 LU bins from -70 LUFS for the integrated gate
+
+	// all zero until configure(), which reads as an empty meter: no steps, nothing gated, no peak
+	int   channels              = 0;
+	float weight[MAX_AV_PLANES] = {};
+
+	// K-weighting: a high shelf then a high-pass, one set of coefficients, per channel state
+	float sb0 = 0, sb1 = 0, sb2 = 0, sa1 = 0, sa2 = 0;
+	float hb0 = 0, hb1 = 0, hb2 = 0, ha1 = 0, ha2 = 0;
+	float z[4][MAX_AV_PLANES] = {};
+
+	// interpolator phases, and the last tp_taps inputs twice over so a window never wraps
+	float tp_coef[4][tp_taps]                 = {};
+	float tp_hist[2 * tp_taps][MAX_AV_PLANES] = {};
+	int   tp_pos                              = 0;
+	float tp_peak[MAX_AV_PLANES]              = {};
+
+	uint32_t step_frames       = 0;
+	uint32_t step_pos          = 0;
+	double   step_energy       = 0;
+	double   steps[steps_kept] = {};
+	uint64_t step_count        = 0;
+
+	// every 400ms block above the absolute gate, by loudness
+	uint64_t gate_count[gate_bins]  = {};
+	double   gate_energy[gate_bins] = {};
+
+	void   process_chunk(const float *const *in, int offset, int frames);
+	void   end_step();
+	double window_energy(int n) const;
+
+public:
+	// clears all state, weights channels as BS.1770 does for the layout (LFE left out, surrounds +1.5 dB)
+	void configure(uint32_t sample_rate, enum speaker_layout speakers);
+
+	// starts integration and peak hold over, the short windows carry on
+	void reset();
+
+	// in holds one float plane per channel of the configured layout
+	void process(const float *const *in, int frames);
+
+	// LUFS, -inf while the window has not filled yet or when silent
+	float momentary() const;
+	float short_term() const;
+	float integrated() const;
+
+	// dBTP since the last reset
+	float true_peak(int channel) const;
+
+	int channel_count() const
+	{
+		return channels;
+	}
+};
@@ -0,0 +1,198 @@
+/*
+Copyright (C) 2019 by andersama <anderson.john.alexander@gmail.com>
+and pkv <pkv.stream@gmail.com>.
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "asio-ring.h"
+#include "asio-export.h"
+
+#include <chrono>
+#include <thread>
+
+bool AsioRing::lease(uint64_t seq, Lease &lease)
+{
+	lease.release();
+	size_t m = _slots.size();
+	if (m == 0)
+		return false;
+
+	Slot &slot = *_slots[seq % m];
+	int   n    = slot.leases.load(std::memory_order_relaxed);
+	do {
+		if (n < 0)
+			return false;
+	} while (!slot.leases.compare_exchange_weak(n, n + 1, std::memory_order_acquire, std::memory_order_relaxed));
+
+	if (slot.sequence.load(std::memory_order_relaxed) != seq) {
+		slot.leases.fetch_sub(1, std::memory_order_release);
+		return false;
+	}
+	lease._slot = &slot;
+	return true;
+}
+
+// the closing side stores its flag before it checks the count, so one of the two always sees the other
+bool AsioRing::enter_read()
+{
+	_readers.fetch_add(1, std::memory_order_seq_cst);
+	if (_readers_shut.load(std::memory_order_seq_cst)) {
+		_readers.fetch_sub(1, std::memory_order_release);
+		return false;
+	}
+	return true;
+}
+
+AsioRing::Slot *AsioRing::begin_write(uint64_t &seq, int &index)
+{
+	// growing only holds the writer off while slot pointers move, wait that out rather than drop the block
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(200);
+	for (;;) {
+		_writer_busy.store(true, std::memory_order_seq_cst);
+		if (!_writer_shut.load(std::memory_order_seq_cst))
+			break;
+		_writer_busy.store(false, std::memory_order_release);
+		if (std::chrono::steady_clock::now() > deadline)
+			return nullptr;
+		std::this_thread::yield();
+	}
+	if (_slots.empty()) {
+		_writer_busy.store(false, std::memory_order_release);
+		return nullptr;
+	}
+	seq   = _write_seq.load(std::memory_order_relaxed);
+	index = (int)(seq % _slots.size());
+
+	// a reader still holds the oldest block, drop the new one instead of writing underneath it
+	Slot *slot      = _slots[index].get();
+	int   free_slot = 0;
+	if (!slot->leases.compare_exchange_strong(free_slot, -1, std::memory_order_acquire)) {
+		_writer_busy.store(false, std::memory_order_release);
+		return nullptr;
+	}
+	return slot;
+}
+
+void AsioRing::end_write(Slot *slot, uint64_t seq)
+{
+	slot->sequence.store(seq, std::memory_order_relaxed);
+	slot->leases.store(0, std::memory_order_release);
+	_write_seq.store(seq + 1, std::memory_order_release);
+	_writer_busy.store(false, std::memory_order_release);
+}
+
+void AsioRing::close()
+{
+	_layout_mutex.lock();
+	_readers_shut.store(true, std::memory_order_seq_cst);
+	while (_readers.load(std::memory_order_seq_cst) != 0)
+		std::this_thread::yield();
+	_writer_shut.store(true, std::memory_order_seq_cst);
+	while (_writer_busy.load(std::memory_order_seq_cst))
+		std::this_thread::yield();
+}
+
+void AsioRing::open()
+{
+	_writer_shut.store(false, std::memory_order_release);
+	_readers_shut.store(false, std::memory_order_release);
+	_layout_mutex.unlock();
+}
+
+void AsioRing::init_slot(Slot &slot, size_t index, AsioExport *ex)
+{
+	size_t plane_size = (size_t)_frames * get_audio_bytes_per_channel(_format);
+	slot.channels     = _channels;
+	slot.planes.resize(_channels);
+	if (ex) {
+		slot.storage.clear();
+		slot.storage.shrink_to_fit();
+		for (int c = 0; c < _channels; c++)
+			slot.planes[c] = ex->plane((int)index, c);
+	} else {
+		slot.storage.assign(plane_size * _channels, 0);
+		for (int c = 0; c < _channels; c++)
+			slot.planes[c] = slot.storage.data() + c * plane_size;
+	}
+	slot.out.format          = _format;
+	slot.out.samples_per_sec = _sample_rate;
+	slot.out.frames          = 0;
+	slot.sequence.store(UINT64_MAX, std::memory_order_relaxed);
+}
+
+void AsioRing::layout(int slot_count, int channels, int frames, enum audio_format format, uint32_t sample_rate,
+		AsioExport *ex)
+{
+	_channels    = channels;
+	_frames      = frames;
+	_format      = format;
+	_sample_rate = sample_rate;
+	_exported    = ex != nullptr;
+	_generation++;
+
+	// fits the ring to the delays asked for now, so one long delay does not keep its slots for good
+	_slots.resize(slot_count);
+	for (auto &slot : _slots) {
+		if (!slot)
+			slot.reset(new Slot());
+	}
+	for (size_t i = 0; i < _slots.size(); i++)
+		init_slot(*_slots[i], i, ex);
+}
+
+bool AsioRing::grow(int slot_count)
+{
+	std::vector<std::unique_ptr<Slot>> fresh;
+	std::vector<std::unique_ptr<Slot>> slots(slot_count);
+	std::vector<std::unique_ptr<Slot>> spare;
+	uint64_t                           generation;
+	{
+		std::lock_guard<std::mutex> lock(_layout_mutex);
+		if ((int)_slots.size() >= slot_count)
+			return true;
+		// the export segment has a fixed slot count
+		if (_exported || _slots.empty())
+			return false;
+		generation = _generation;
+		// allocated up front, so the ring is only closed while the pointers move
+		for (size_t i = _slots.size(); i < (size_t)slot_count; i++) {
+			fresh.emplace_back(new Slot());
+			init_slot(*fresh.back(), i, nullptr);
+		}
+		spare.reserve(_slots.size());
+	}
+
+	close();
+	// laid out again in the meantime, the new slots may not match it any more
+	if (generation != _generation) {
+		open();
+		return false;
+	}
+	// the valid blocks cover fewer sequences than the new ring has slots, so each gets a slot of its own
+	for (auto &slot : _slots) {
+		uint64_t seq = slot->sequence.load(std::memory_order_relaxed);
+		if (seq == UINT64_MAX)
+			spare.push_back(std::move(slot));
+		else
+			slots[seq % slot_count] = std::move(slot);
+	}
+	for (auto &slot : slots) {
+		if (slot)
+			continue;
+		std::vector<std::unique_ptr<Slot>> &from = spare.empty() ? fresh : spare;
+		slot = std::move(from.back());
+		from.pop_back();
+	}
+	_slots.swap(slots);
+	open();
+	return true;
+}
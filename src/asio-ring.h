@@ -0,0 +1,220 @@
+/*
+Copyright (C) 2019 by andersama <anderson.john.alexander@gmail.com>
+and pkv <pkv.stream@gmail.com>.
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <obs-module.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+class AsioExport;
+
+// The block ring between a driver callback and its readers. One writer fills the slots in sequence order. Readers
+// take leases on the blocks they use, so they can hand the planes on (to OBS or anything else) without copying them,
+// and the writer drops a block rather than write into a leased slot.
+//
+// Laying the ring out again frees and moves the slots, so it happens with the ring closed: readers get in through a
+// ReadGuard and the writer through begin_write, and close() waits until both have left and keeps them out until
+// open(). No lease can outlive the ReadGuard it was taken under. The writer waits briefly for a closed ring to open
+// again before it drops a block.
+class AsioRing {
+public:
+	struct Slot {
+		// planes point into storage, or into the export segment when the ring is exported
+		std::vector<uint8_t>   storage;
+		std::vector<uint8_t *> planes;
+		int                    channels = 0;
+		obs_source_audio       out      = {};
+		// number of readers holding the slot, -1 while the writer is filling it
+		std::atomic<int> leases = {0};
+		// write sequence of the block currently stored in the slot
+		std::atomic<uint64_t> sequence = {UINT64_MAX};
+		// when readers may deliver the block, its arrival unless the jitter buffer holds it back
+		uint64_t release = 0;
+	};
+
+	// A read lease on one slot. While it is held the writer will not write into the slot.
+	class Lease {
+	private:
+		Slot *_slot = nullptr;
+		friend class AsioRing;
+
+	public:
+		Lease() = default;
+		Lease(const Lease &) = delete;
+		Lease &operator=(const Lease &) = delete;
+
+		Lease(Lease &&other) noexcept : _slot(other._slot)
+		{
+			other._slot = nullptr;
+		}
+
+		Lease &operator=(Lease &&other) noexcept
+		{
+			if (this != &other) {
+				release();
+				_slot       = other._slot;
+				other._slot = nullptr;
+			}
+			return *this;
+		}
+
+		~Lease()
+		{
+			release();
+		}
+
+		void release()
+		{
+			if (_slot) {
+				_slot->leases.fetch_sub(1, std::memory_order_release);
+				_slot = nullptr;
+			}
+		}
+
+		Slot *get() const
+		{
+			return _slot;
+		}
+
+		explicit operator bool() const
+		{
+			return _slot != nullptr;
+		}
+	};
+
+	// Admits a reader to the ring for one pass. Check it before touching the ring, it is false while the ring is
+	// closed and the reader should come back later.
+	class ReadGuard {
+	private:
+		AsioRing *_ring;
+		bool      _entered;
+
+	public:
+		explicit ReadGuard(AsioRing &ring) : _ring(&ring), _entered(ring.enter_read())
+		{
+		}
+		ReadGuard(const ReadGuard &) = delete;
+		ReadGuard &operator=(const ReadGuard &) = delete;
+
+		~ReadGuard()
+		{
+			if (_entered)
+				_ring->_readers.fetch_sub(1, std::memory_order_release);
+		}
+
+		explicit operator bool() const
+		{
+			return _entered;
+		}
+	};
+
+private:
+	std::vector<std::unique_ptr<Slot>> _slots;
+	std::atomic<uint64_t>              _write_seq    = {0};
+	std::atomic<int>                   _readers      = {0};
+	std::atomic<bool>                  _readers_shut = {false};
+	std::atomic<bool>                  _writer_busy  = {false};
+	std::atomic<bool>                  _writer_shut  = {false};
+	std::mutex                         _layout_mutex;
+
+	// what the slots were last laid out as, grow() lays out the new ones the same way
+	int               _channels    = 0;
+	int               _frames      = 0;
+	enum audio_format _format      = AUDIO_FORMAT_FLOAT_PLANAR;
+	uint32_t          _sample_rate = 0;
+	bool              _exported    = false;
+	uint64_t          _generation  = 0;
+
+	bool enter_read();
+	void init_slot(Slot &slot, size_t index, AsioExport *ex);
+
+public:
+	// sequence number of the next block the writer will fill, every block below it is readable
+	uint64_t write_sequence() const
+	{
+		return _write_seq.load(std::memory_order_acquire);
+	}
+
+	size_t size() const
+	{
+		return _slots.size();
+	}
+
+	// Takes a lease on the block written with sequence number seq. Fails if that block has already been
+	// overwritten (or is being overwritten) because the reader fell more than a full ring behind.
+	bool lease(uint64_t seq, Lease &lease);
+
+	// One reader pass the way listeners make it, under a ReadGuard. Walks read_seq up to the write sequence and
+	// hands each block to take(seq, slot) while it is leased, or stops at a block take() returns false for because
+	// it is not due yet. Blocks that were overwritten before the reader got to them go to missed(first, count).
+	template<typename Take, typename Missed> void read(uint64_t &read_seq, Take &&take, Missed &&missed)
+	{
+		uint64_t write_seq = write_sequence();
+		uint64_t m         = size();
+		// anything older than one full ring has already been overwritten
+		if (write_seq - read_seq > m) {
+			missed(read_seq, write_seq - m - read_seq);
+			read_seq = write_seq - m;
+		}
+		while (read_seq != write_seq) {
+			Lease held;
+			if (!lease(read_seq, held)) {
+				missed(read_seq, 1);
+				read_seq++;
+				continue;
+			}
+			if (!take(read_seq, *held.get()))
+				break;
+			read_seq++;
+		}
+	}
+
+	// writer: claims the slot for the next block, nullptr when a reader still holds it or the ring is closed and
+	// the block is dropped
+	Slot *begin_write(uint64_t &seq, int &index);
+
+	// writer: publishes the block claimed by begin_write
+	void end_write(Slot *slot, uint64_t seq);
+
+	// waits for every reader and the writer to leave the ring and keeps them out until open()
+	void close();
+	void open();
+
+	// lays out slot_count empty slots of channels planes, in owned storage or in the segment of ex, only while
+	// the ring is closed; slots past slot_count are freed
+	void layout(int slot_count, int channels, int frames, enum audio_format format, uint32_t sample_rate,
+			AsioExport *ex);
+
+	// Adds slots while the ring is running. Every block keeps its sequence and moves to the slot that sequence
+	// maps to in the larger ring, so readers lose nothing. Fails on an exported ring, which has to be laid out
+	// again instead.
+	bool grow(int slot_count);
+};
+
+// How long a listener sleeps after a pass: half a mixer block at the rate it delivered at, or until the block it left
+// in the ring is due (next_release, 0 for none) if that comes first. A pass that delivered nothing has no rate to go
+// by and falls back to 48 kHz. Shared with the offline trace replay.
+static inline int ring_reader_wait_ms(int sample_rate, uint64_t now, uint64_t next_release)
+{
+	int wait = ((1000 / 2) * AUDIO_OUTPUT_FRAMES) / (sample_rate < 8000 ? 48000 : sample_rate);
+	if (next_release)
+		return std::min(wait, (int)((next_release - now) / 1000000) + 1);
+	return wait;
+}
@@ -0,0 +1,199 @@
+/*
+Copyright (C) 2019 by andersama <anderson.john.alexander@gmail.com>
+and pkv <pkv.stream@gmail.com>.
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+// Four lane float helpers shared by the processing stages, which run channels in groups of four, one per lane.
+
+#include <obs-module.h>
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ASIO_SSE2 1
+#endif
+
+// four lanes of floats and lane masks, SSE2 when available
+#ifdef ASIO_SSE2
+struct v4 {
+	__m128 v;
+};
+struct m4 {
+	__m128 v;
+};
+static inline v4 v4_set(float a)
+{
+	return {_mm_set1_ps(a)};
+}
+static inline v4 v4_load(const float *p)
+{
+	return {_mm_loadu_ps(p)};
+}
+static inline void v4_store(float *p, v4 a)
+{
+	_mm_storeu_ps(p, a.v);
+}
+static inline v4 operator+(v4 a, v4 b)
+{
+	return {_mm_add_ps(a.v, b.v)};
+}
+static inline v4 operator-(v4 a, v4 b)
+{
+	return {_mm_sub_ps(a.v, b.v)};
+}
+static inline v4 operator*(v4 a, v4 b)
+{
+	return {_mm_mul_ps(a.v, b.v)};
+}
+static inline v4 v4_min(v4 a, v4 b)
+{
+	return {_mm_min_ps(a.v, b.v)};
+}
+static inline v4 v4_max(v4 a, v4 b)
+{
+	return {_mm_max_ps(a.v, b.v)};
+}
+static inline v4 v4_abs(v4 a)
+{
+	return {_mm_andnot_ps(_mm_set1_ps(-0.0f), a.v)};
+}
+static inline m4 operator>(v4 a, v4 b)
+{
+	return {_mm_cmpgt_ps(a.v, b.v)};
+}
+static inline m4 operator<(v4 a, v4 b)
+{
+	return {_mm_cmplt_ps(a.v, b.v)};
+}
+static inline m4 operator&(m4 a, m4 b)
+{
+	return {_mm_and_ps(a.v, b.v)};
+}
+static inline m4 operator|(m4 a, m4 b)
+{
+	return {_mm_or_ps(a.v, b.v)};
+}
+static inline m4 operator~(m4 a)
+{
+	return {_mm_xor_ps(a.v, _mm_castsi128_ps(_mm_set1_epi32(-1)))};
+}
+static inline v4 v4_select(m4 m, v4 a, v4 b)
+{
+	return {_mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v))};
+}
+#else
+struct v4 {
+	float f[4];
+};
+struct m4 {
+	bool b[4];
+};
+#define V4_LANES(expr)                    \
+	do {                              \
+		for (int l = 0; l < 4; l++) \
+			expr;             \
+	} while (false)
+static inline v4 v4_set(float a)
+{
+	return {{a, a, a, a}};
+}
+static inline v4 v4_load(const float *p)
+{
+	return {{p[0], p[1], p[2], p[3]}};
+}
+static inline void v4_store(float *p, v4 a)
+{
+	memcpy(p, a.f, sizeof(a.f));
+}
+static inline v4 operator+(v4 a, v4 b)
+{
+	V4_LANES(a.f[l] += b.f[l]);
+	return a;
+}
+static inline v4 operator-(v4 a, v4 b)
+{
+	V4_LANES(a.f[l] -= b.f[l]);
+	return a;
+}
+static inline v4 operator*(v4 a, v4 b)
+{
+	V4_LANES(a.f[l] *= b.f[l]);
+	return a;
+}
+static inline v4 v4_min(v4 a, v4 b)
+{
+	V4_LANES(a.f[l] = std::min(a.f[l], b.f[l]));
+	return a;
+}
+static inline v4 v4_max(v4 a, v4 b)
+{
+	V4_LANES(a.f[l] = std::max(a.f[l], b.f[l]));
+	return a;
+}
+static inline v4 v4_abs(v4 a)
+{
+	V4_LANES(a.f[l] = fabsf(a.f[l]));
+	return a;
+}
+static inline m4 operator>(v4 a, v4 b)
+{
+	m4 m;
+	V4_LANES(m.b[l] = a.f[l] > b.f[l]);
+	return m;
+}
+static inline m4 operator<(v4 a, v4 b)
+{
+	m4 m;
+	V4_LANES(m.b[l] = a.f[l] < b.f[l]);
+	return m;
+}
+static inline m4 operator&(m4 a, m4 b)
+{
+	V4_LANES(a.b[l] = a.b[l] && b.b[l]);
+	return a;
+}
+static inline m4 operator|(m4 a, m4 b)
+{
+	V4_LANES(a.b[l] = a.b[l] || b.b[l]);
+	return a;
+}
+static inline m4 operator~(m4 a)
+{
+	V4_LANES(a.b[l] = !a.b[l]);
+	return a;
+}
+static inline v4 v4_select(m4 m, v4 a, v4 b)
+{
+	V4_LANES(a.f[l] = m.b[l] ? a.f[l] : b.f[l]);
+	return a;
+}
+#endif
+
+static_assert(MAX_AV_PLANES % 4 == 0, "channels are processed in groups of four lanes");
+
+// sample i of a plane in one of the ring formats, as float
+static inline float load_sample(const uint8_t *plane, int i, enum audio_format format)
+{
+	switch (format) {
+	case AUDIO_FORMAT_16BIT_PLANAR:
+		return ((const int16_t *)plane)[i] * (1.0f / 32768.0f);
+	case AUDIO_FORMAT_32BIT_PLANAR:
+		return ((const int32_t *)plane)[i] * (1.0f / 2147483648.0f);
+	default:
+		return ((const float *)plane)[i];
+	}
+}
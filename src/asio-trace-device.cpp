@@ -0,0 +1,259 @@
+/*
+Copyright (C) 2019 by andersama <anderson.john.alexander@gmail.com>
+and pkv <pkv.stream@gmail.com>.
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "asio-trace.h"
+
+#include <util/bmem.h>
+#include <util/platform.h>
+#include <obs-module.h>
+#include <cmath>
+#include <juce_core/juce_core.h>
+#include <juce_audio_devices/juce_audio_devices.h>
+
+std::string trace_folder()
+{
+	char       *dir = obs_module_config_path("traces");
+	std::string folder(dir ? dir : "");
+	bfree(dir);
+	return folder;
+}
+
+std::vector<std::string> trace_device_names()
+{
+	std::vector<std::string> names;
+	std::string              pattern = trace_folder() + "/*" + ASIO_TRACE_EXTENSION;
+	os_glob_t               *glob;
+	if (os_glob(pattern.c_str(), 0, &glob) != 0)
+		return names;
+	for (size_t i = 0; i < glob->gl_pathc; i++) {
+		if (glob->gl_pathv[i].directory)
+			continue;
+		const char *file = strrchr(glob->gl_pathv[i].path, '/');
+		names.push_back(std::string(ASIO_TRACE_DEVICE_PREFIX) + (file ? file + 1 : glob->gl_pathv[i].path));
+	}
+	os_globfree(glob);
+	return names;
+}
+
+// A device that plays the driver callbacks of a trace back through whatever callback starts it, with the recorded
+// block sizes and inter-arrival times, looping at the end. Inputs carry a continuous sine so any dropped or
+// repeated block is audible.
+class TraceReplayDevice : public juce::AudioIODevice, private juce::Thread {
+private:
+	asio_trace_header             header = {};
+	std::vector<asio_trace_event> events;
+	juce::AudioIODeviceCallback  *callback = nullptr;
+	bool                          opened   = false;
+	juce::String                  last_error;
+
+	// sleeps until time in short steps so stop() never has to wait out a long gap in the trace
+	bool sleep_until(uint64_t time)
+	{
+		for (;;) {
+			if (threadShouldExit())
+				return false;
+			uint64_t now = os_gettime_ns();
+			if (now >= time)
+				return true;
+			if (time - now > 50000000) {
+				os_sleep_ms(20);
+				continue;
+			}
+			os_sleepto_ns(time);
+			return !threadShouldExit();
+		}
+	}
+
+	void run() override
+	{
+		int                             channels = (int)header.channels;
+		int                             frames   = (int)header.frames;
+		std::vector<std::vector<float>> planes(channels, std::vector<float>(frames));
+		std::vector<const float *>      ptrs(channels);
+		const double                    two_pi = 6.283185307179586;
+		double                          phase  = 0.0;
+		double                          step   = two_pi * 440.0 / header.sample_rate;
+		for (int c = 0; c < channels; c++)
+			ptrs[c] = planes[c].data();
+
+		uint64_t start = os_gettime_ns();
+		while (!threadShouldExit()) {
+			uint64_t first = 0;
+			uint64_t last  = 0;
+			for (const asio_trace_event &ev : events) {
+				if (ev.type != ASIO_TRACE_CALLBACK && ev.type != ASIO_TRACE_OVERRUN)
+					continue;
+				if (!first)
+					first = ev.time;
+				last = ev.time;
+				if (!sleep_until(start + (ev.time - first)))
+					return;
+
+				int n = std::min((int)ev.frames, frames);
+				for (int i = 0; i < n; i++) {
+					float v = (float)(0.25 * std::sin(phase));
+					for (int c = 0; c < channels; c++)
+						planes[c][i] = v;
+					phase = std::fmod(phase + step, two_pi);
+				}
+				callback->audioDeviceIOCallback(ptrs.data(), channels, nullptr, 0, n);
+			}
+			if (!first)
+				return;
+			start += (last - first) + (uint64_t)frames * 1000000000ULL / header.sample_rate;
+		}
+	}
+
+public:
+	TraceReplayDevice(const juce::String &name, const std::string &path)
+		: juce::AudioIODevice(name, "Trace"), juce::Thread("trace replay")
+	{
+		if (!AsioTrace::load(path.c_str(), header, events) || !header.sample_rate || !header.frames) {
+			last_error = "Could not read trace";
+			header     = {};
+			events.clear();
+		}
+	}
+
+	~TraceReplayDevice() override
+	{
+		close();
+	}
+
+	juce::StringArray getOutputChannelNames() override
+	{
+		return {};
+	}
+
+	juce::StringArray getInputChannelNames() override
+	{
+		juce::StringArray names;
+		for (uint32_t i = 0; i < header.channels; i++)
+			names.add("Trace " + juce::String(i + 1));
+		return names;
+	}
+
+	juce::Array<double> getAvailableSampleRates() override
+	{
+		return {(double)header.sample_rate};
+	}
+
+	juce::Array<int> getAvailableBufferSizes() override
+	{
+		return {(int)header.frames};
+	}
+
+	int getDefaultBufferSize() override
+	{
+		return (int)header.frames;
+	}
+
+	juce::String open(const juce::BigInteger &inputChannels, const juce::BigInteger &outputChannels,
+			double sampleRate, int bufferSizeSamples) override
+	{
+		UNUSED_PARAMETER(inputChannels);
+		UNUSED_PARAMETER(outputChannels);
+		UNUSED_PARAMETER(sampleRate);
+		UNUSED_PARAMETER(bufferSizeSamples);
+		opened = last_error.isEmpty();
+		return last_error;
+	}
+
+	void close() override
+	{
+		stop();
+		opened = false;
+	}
+
+	bool isOpen() override
+	{
+		return opened;
+	}
+
+	void start(juce::AudioIODeviceCallback *cb) override
+	{
+		if (!opened || !cb || isThreadRunning())
+			return;
+		callback = cb;
+		callback->audioDeviceAboutToStart(this);
+		startThread(9);
+	}
+
+	void stop() override
+	{
+		if (!isThreadRunning())
+			return;
+		stopThread(1000);
+		if (callback)
+			callback->audioDeviceStopped();
+		callback = nullptr;
+	}
+
+	bool isPlaying() override
+	{
+		return isThreadRunning();
+	}
+
+	juce::String getLastError() override
+	{
+		return last_error;
+	}
+
+	int getCurrentBufferSizeSamples() override
+	{
+		return (int)header.frames;
+	}
+
+	double getCurrentSampleRate() override
+	{
+		return (double)header.sample_rate;
+	}
+
+	int getCurrentBitDepth() override
+	{
+		return (int)header.bit_depth;
+	}
+
+	juce::BigInteger getActiveOutputChannels() const override
+	{
+		return {};
+	}
+
+	juce::BigInteger getActiveInputChannels() const override
+	{
+		juce::BigInteger in;
+		in.setRange(0, (int)header.channels, true);
+		return in;
+	}
+
+	int getOutputLatencyInSamples() override
+	{
+		return 0;
+	}
+
+	int getInputLatencyInSamples() override
+	{
+		return 0;
+	}
+};
+
+juce::AudioIODevice *create_trace_device(const std::string &name)
+{
+	std::string prefix = ASIO_TRACE_DEVICE_PREFIX;
+	if (name.compare(0, prefix.size(), prefix) != 0)
+		return nullptr;
+	std::string path = trace_folder() + "/" + name.substr(prefix.size());
+	return new TraceReplayDevice(juce::String(name.c_str()), path);
+}
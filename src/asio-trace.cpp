@@ -0,0 +1,113 @@
+/*
+Copyright (C) 2019 by andersama <anderson.john.alexander@gmail.com>
+and pkv <pkv.stream@gmail.com>.
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "asio-trace.h"
+
+#include <util/platform.h>
+#include <obs-module.h>
+#include <stdio.h>
+
+#define blog(level, msg, ...) blog(level, "asio-input: " msg, ##__VA_ARGS__)
+
+AsioTrace::AsioTrace(size_t capacity)
+{
+	size_t size = 1;
+	while (size < capacity)
+		size <<= 1;
+	_events.resize(size);
+	_stamps.reset(new std::atomic<uint64_t>[size]);
+	for (size_t i = 0; i < size; i++)
+		_stamps[i].store(0, std::memory_order_relaxed);
+	_mask = size - 1;
+	set_format("", 0, 0, 0, 0);
+}
+
+void AsioTrace::set_format(const char *device, uint32_t sample_rate, uint32_t frames, uint32_t channels,
+		uint32_t bit_depth)
+{
+	_format             = {};
+	_format.magic       = ASIO_TRACE_MAGIC;
+	_format.version     = ASIO_TRACE_VERSION;
+	_format.sample_rate = sample_rate;
+	_format.frames      = frames;
+	_format.channels    = channels;
+	_format.bit_depth   = bit_depth;
+	snprintf(_format.device, sizeof(_format.device), "%s", device);
+}
+
+std::string AsioTrace::dump(const std::string &folder) const
+{
+	// take a consistent copy first, writers keep going while we read
+	uint64_t                      end   = _next.load(std::memory_order_acquire);
+	uint64_t                      begin = end > _events.size() ? end - _events.size() : 0;
+	std::vector<asio_trace_event> events;
+	events.reserve((size_t)(end - begin));
+	for (uint64_t n = begin; n < end; n++) {
+		size_t i = (size_t)(n & _mask);
+		if (_stamps[i].load(std::memory_order_acquire) != n + 1)
+			continue;
+		asio_trace_event ev = _events[i];
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (_stamps[i].load(std::memory_order_relaxed) == n + 1)
+			events.push_back(ev);
+	}
+
+	if (folder.empty() || os_mkdirs(folder.c_str()) == MKDIR_ERROR) {
+		blog(LOG_WARNING, "Could not create trace folder %s", folder.c_str());
+		return "";
+	}
+
+	std::string name;
+	for (const char *c = _format.device; *c; c++) {
+		bool alnum = (*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9');
+		name.push_back(alnum ? *c : '_');
+	}
+	std::string path = folder + "/" + name + "-" + std::to_string(os_gettime_ns() / 1000000) +
+			   ASIO_TRACE_EXTENSION;
+
+	asio_trace_header header = _format;
+	header.event_count       = events.size();
+
+	FILE *f = os_fopen(path.c_str(), "wb");
+	if (!f) {
+		blog(LOG_WARNING, "Could not write trace %s", path.c_str());
+		return "";
+	}
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+	if (ok && !events.empty())
+		ok = fwrite(events.data(), sizeof(asio_trace_event), events.size(), f) == events.size();
+	fclose(f);
+	if (!ok) {
+		blog(LOG_WARNING, "Could not write trace %s", path.c_str());
+		return "";
+	}
+	return path;
+}
+
+bool AsioTrace::load(const char *path, asio_trace_header &header, std::vector<asio_trace_event> &events)
+{
+	FILE *f = os_fopen(path, "rb");
+	if (!f)
+		return false;
+	bool ok = fread(&header, sizeof(header), 1, f) == 1 && header.magic == ASIO_TRACE_MAGIC &&
+		  header.version == ASIO_TRACE_VERSION && header.event_count < (1ULL << 32);
+	if (ok) {
+		events.resize((size_t)header.event_count);
+		ok = events.empty() ||
+		     fread(events.data(), sizeof(asio_trace_event), events.size(), f) == events.size();
+	}
+	fclose(f);
+	return ok;
+}
@@ -0,0 +1,108 @@
+/*
+Copyright (C) 2019 by andersama <anderson.john.alexander@gmail.com>
+and pkv <pkv.stream@gmail.com>.
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace juce {
+class AudioIODevice;
+}
+
+/* Callback timing traces.
+ *
+ * Every device keeps the last events of its capture path in memory. A trace file is an asio_trace_header followed
+ * by event_count asio_trace_events, oldest first. Traces are written to the plugin config folder under "traces"
+ * and show up as replay devices named ASIO_TRACE_DEVICE_PREFIX + file name, which play the recorded driver
+ * callbacks back through the capture path with their original timing. Those still run on live OS scheduling, the
+ * asio-trace-replay test target replays a trace on a virtual clock instead to measure delivery deterministically.
+ */
+
+#define ASIO_TRACE_MAGIC 0x52545341 /* "ASTR" */
+#define ASIO_TRACE_VERSION 1
+#define ASIO_TRACE_EXTENSION ".asiotrace"
+#define ASIO_TRACE_DEVICE_PREFIX "Trace: "
+
+enum asio_trace_type {
+	ASIO_TRACE_CALLBACK, /* driver wrote a block: seq, frames, ring index */
+	ASIO_TRACE_OVERRUN,  /* driver block dropped on a leased slot: seq, frames, ring index */
+	ASIO_TRACE_DELIVER,  /* listener handed a block to obs: seq, frames, listener id */
+	ASIO_TRACE_MISS,     /* listener lost blocks overwritten before it read them: first seq, count, listener id */
+	ASIO_TRACE_WAKE,     /* dispatcher woke a listener late: read seq, microseconds late, listener id */
+};
+
+struct asio_trace_event {
+	uint64_t time; /* os_gettime_ns */
+	uint64_t seq;
+	uint32_t frames;
+	uint16_t type;
+	uint16_t index;
+};
+
+struct asio_trace_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t sample_rate;
+	uint32_t frames;
+	uint32_t channels;
+	uint32_t bit_depth;
+	uint64_t event_count;
+	char     device[64];
+};
+
+class AsioTrace {
+private:
+	std::vector<asio_trace_event>            _events;
+	std::unique_ptr<std::atomic<uint64_t>[]> _stamps;
+	size_t                                   _mask;
+	std::atomic<uint64_t>                    _next = {0};
+	asio_trace_header                        _format;
+
+public:
+	// capacity is rounded up to a power of two
+	explicit AsioTrace(size_t capacity);
+
+	void set_format(const char *device, uint32_t sample_rate, uint32_t frames, uint32_t channels,
+			uint32_t bit_depth);
+
+	// safe to call from any thread, the oldest events are overwritten once the trace is full
+	void record(asio_trace_type type, uint64_t time, uint64_t seq, uint32_t frames, uint16_t index)
+	{
+		uint64_t n = _next.fetch_add(1, std::memory_order_relaxed);
+		size_t   i = (size_t)(n & _mask);
+		_stamps[i].store(0, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		_events[i] = {time, seq, frames, (uint16_t)type, index};
+		_stamps[i].store(n + 1, std::memory_order_release);
+	}
+
+	// writes the trace to folder, returns the file path or an empty string on failure
+	std::string dump(const std::string &folder) const;
+
+	static bool load(const char *path, asio_trace_header &header, std::vector<asio_trace_event> &events);
+};
+
+// the "traces" folder in the plugin config folder, which the devices below are read from
+std::string trace_folder();
+
+// names of the replay devices for the traces found in the config folder
+std::vector<std::string> trace_device_names();
+
+// nullptr if name is not a trace replay device
+juce::AudioIODevice *create_trace_device(const std::string &name);
@@ -0,0 +1,202 @@
+/*
+Copyright (C) 2019 by andersama <anderson.john.alexander@gmail.com>
+and pkv <pkv.stream@gmail.com>.
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Benchmark of the fused processing stage against the filter chain it replaces.
+ *
+ * The chain is what OBS does with the same three stages as separate filters: the source converts the block to float
+ * planes, then a gain filter, a high-pass and a noise gate each make their own pass over every plane, one channel
+ * and one sample at a time. Both produce the same output, which is checked before timing.
+ */
+
+#include "asio-dsp.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#define CHANNELS 8
+#define FRAMES 480
+#define BLOCKS 20000
+
+// the separate filters, with the same coefficients and per channel state as AsioDsp
+struct FilterChain {
+	float gain[CHANNELS];
+	float b0, b1, b2, a1, a2;
+	float open_threshold, close_threshold, decay, attack, release, hold_samples;
+	float z1[CHANNELS] = {}, z2[CHANNELS] = {};
+	float env[CHANNELS] = {}, held[CHANNELS] = {}, open[CHANNELS] = {}, gate_gain[CHANNELS] = {};
+
+	void configure(const asio_dsp_params &p, float rate)
+	{
+		for (int c = 0; c < CHANNELS; c++)
+			gain[c] = powf(10.0f, p.gain_db[c] / 20.0f);
+		float w0        = 2.0f * 3.14159265f * p.hpf_hz / rate;
+		float cosw      = cosf(w0);
+		float alpha     = sinf(w0) / (2.0f * 0.70710678f);
+		float a0        = 1.0f + alpha;
+		b0              = (1.0f + cosw) / 2.0f / a0;
+		b1              = -(1.0f + cosw) / a0;
+		b2              = b0;
+		a1              = -2.0f * cosw / a0;
+		a2              = (1.0f - alpha) / a0;
+		open_threshold  = powf(10.0f, p.gate_open_db / 20.0f);
+		close_threshold = powf(10.0f, p.gate_close_db / 20.0f);
+		decay           = expf(-1.0f / (rate * 0.01f));
+		attack          = 1.0f / std::max(p.gate_attack_ms * rate / 1000.0f, 1.0f);
+		release         = 1.0f / std::max(p.gate_release_ms * rate / 1000.0f, 1.0f);
+		hold_samples    = p.gate_hold_ms * rate / 1000.0f;
+	}
+
+	void convert(const int16_t *const *in, float *const *out, int frames)
+	{
+		for (int c = 0; c < CHANNELS; c++) {
+			for (int i = 0; i < frames; i++)
+				out[c][i] = in[c][i] * (1.0f / 32768.0f);
+		}
+	}
+
+	void gain_filter(float *const *data, int frames)
+	{
+		for (int c = 0; c < CHANNELS; c++) {
+			for (int i = 0; i < frames; i++)
+				data[c][i] *= gain[c];
+		}
+	}
+
+	void high_pass(float *const *data, int frames)
+	{
+		for (int c = 0; c < CHANNELS; c++) {
+			float s1 = z1[c], s2 = z2[c];
+			for (int i = 0; i < frames; i++) {
+				float x    = data[c][i];
+				float y    = b0 * x + s1;
+				s1         = b1 * x - a1 * y + s2;
+				s2         = b2 * x - a2 * y;
+				data[c][i] = y;
+			}
+			z1[c] = s1;
+			z2[c] = s2;
+		}
+	}
+
+	void noise_gate(float *const *data, int frames)
+	{
+		for (int c = 0; c < CHANNELS; c++) {
+			for (int i = 0; i < frames; i++) {
+				float x = data[c][i];
+				env[c]  = std::max(fabsf(x), env[c] * decay);
+				bool is_open = open[c] > 0.5f;
+				bool below   = env[c] < close_threshold;
+				held[c]      = is_open && below ? held[c] + 1.0f : 0.0f;
+				bool closing = is_open && below && held[c] > hold_samples;
+				is_open      = (is_open || env[c] > open_threshold) && !closing;
+				open[c]      = is_open ? 1.0f : 0.0f;
+				gate_gain[c] = is_open ? std::min(gate_gain[c] + attack, 1.0f)
+						       : std::max(gate_gain[c] - release, 0.0f);
+				data[c][i] = x * gate_gain[c];
+			}
+		}
+	}
+};
+
+template<typename F> static double time_blocks(F &&block)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (int b = 0; b < BLOCKS; b++)
+		block(b);
+	std::chrono::duration<double, std::nano> spent = std::chrono::steady_clock::now() - start;
+	return spent.count() / BLOCKS;
+}
+
+int main()
+{
+	const float     rate   = 48000.0f;
+	asio_dsp_params params = {};
+	for (int c = 0; c < MAX_AV_PLANES; c++)
+		params.gain_db[c] = -6.0f + c;
+	params.hpf_hz          = 80.0f;
+	params.gate            = true;
+	params.gate_open_db    = -26.0f;
+	params.gate_close_db   = -32.0f;
+	params.gate_attack_ms  = 25.0f;
+	params.gate_hold_ms    = 200.0f;
+	params.gate_release_ms = 150.0f;
+
+	// a tone that comes and goes, so the gate opens and closes, in 16 bit like a typical driver
+	std::vector<std::vector<int16_t>> input(CHANNELS, std::vector<int16_t>((size_t)FRAMES * 100));
+	for (int c = 0; c < CHANNELS; c++) {
+		for (size_t i = 0; i < input[c].size(); i++) {
+			float level = (i / 24000) % 2 ? 0.3f : 0.001f;
+			float phase = 2.0f * 3.14159265f * (200.0f + 50.0f * c) * i / rate;
+			input[c][i] = (int16_t)(32767.0f * level * sinf(phase));
+		}
+	}
+	auto block_in = [&](int b, int c) {
+		return input[c].data() + (size_t)(b % 100) * FRAMES;
+	};
+
+	std::vector<std::vector<float>> fused_out(CHANNELS, std::vector<float>(FRAMES));
+	std::vector<std::vector<float>> chain_out(CHANNELS, std::vector<float>(FRAMES));
+	float                          *fused_planes[CHANNELS];
+	float                          *chain_planes[CHANNELS];
+	for (int c = 0; c < CHANNELS; c++) {
+		fused_planes[c] = fused_out[c].data();
+		chain_planes[c] = chain_out[c].data();
+	}
+
+	AsioDsp     dsp;
+	FilterChain chain;
+	auto        fused_block = [&](int b) {
+		const uint8_t *in[CHANNELS];
+		for (int c = 0; c < CHANNELS; c++)
+			in[c] = (const uint8_t *)block_in(b, c);
+		dsp.process(in, AUDIO_FORMAT_16BIT_PLANAR, fused_planes, CHANNELS, FRAMES);
+	};
+	auto chain_block = [&](int b) {
+		const int16_t *in[CHANNELS];
+		for (int c = 0; c < CHANNELS; c++)
+			in[c] = block_in(b, c);
+		chain.convert(in, chain_planes, FRAMES);
+		chain.gain_filter(chain_planes, FRAMES);
+		chain.high_pass(chain_planes, FRAMES);
+		chain.noise_gate(chain_planes, FRAMES);
+	};
+
+	// same output first, over enough blocks for the gate to open and close a few times
+	dsp.configure(params, (uint32_t)rate);
+	chain.configure(params, rate);
+	float diff = 0.0f;
+	for (int b = 0; b < 400; b++) {
+		fused_block(b);
+		chain_block(b);
+		for (int c = 0; c < CHANNELS; c++) {
+			for (int i = 0; i < FRAMES; i++)
+				diff = std::max(diff, fabsf(fused_out[c][i] - chain_out[c][i]));
+		}
+	}
+	if (diff > 1e-4f) {
+		fprintf(stderr, "fused output differs from the filter chain by %g\n", diff);
+		return 1;
+	}
+
+	double chain_ns = time_blocks(chain_block);
+	double fused_ns = time_blocks(fused_block);
+	printf("%d channels x %d frames, 16 bit in: filter chain %.0f ns/block, fused %.0f ns/block (%.2fx), "
+	       "max difference %g\n",
+			CHANNELS, FRAMES, chain_ns, fused_ns, chain_ns / fused_ns, diff);
+	return 0;
+}
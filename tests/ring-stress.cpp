@@ -0,0 +1,274 @@
+/*
+Copyright (C) 2019 by andersama <anderson.john.alexander@gmail.com>
+and pkv <pkv.stream@gmail.com>.
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Stress test for the block ring, meant to be built with -fsanitize=thread.
+ *
+ * A mock device thread writes blocks whose samples all hold the block's sequence number while reader threads read
+ * them through AsioRing::read() the way listeners do and check every sample they see. A delayed reader stays a fixed
+ * number of blocks behind and must not lose any block when the ring grows underneath it. A holding reader keeps its
+ * lease until the writer comes round to that slot, which must drop its block rather than write over the held one.
+ * Meanwhile a control thread grows the ring and lays it out again the way a device restart does.
+ */
+
+#include "asio-ring.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define CHANNELS 2
+#define FRAMES 64
+
+static std::atomic<bool>     stop         = {false};
+static std::atomic<uint64_t> errors       = {0};
+static std::atomic<uint64_t> delayed_lost = {0};
+static std::atomic<int>      relayouts    = {0};
+static std::atomic<uint64_t> dropped      = {0};
+static std::atomic<uint64_t> held_drops   = {0};
+
+// a pass that holds on stalls a closing ring with every other reader shut out while the writer carries on, so the
+// holding reader stays clear of the control thread's grows and relayouts
+static std::mutex control_mutex;
+
+// the value every sample of block seq holds, exact in a float
+static float block_value(uint64_t seq)
+{
+	return (float)(seq & 0xffffff);
+}
+
+static void device(AsioRing &ring, uint64_t &written)
+{
+	while (!stop.load()) {
+		uint64_t        seq   = 0;
+		int             index = 0;
+		AsioRing::Slot *slot  = ring.begin_write(seq, index);
+		if (!slot) {
+			dropped++;
+		} else {
+			for (int c = 0; c < slot->channels; c++) {
+				float *dst = (float *)slot->planes[c];
+				for (int i = 0; i < FRAMES; i++)
+					dst[i] = block_value(seq);
+			}
+			slot->out.frames    = FRAMES;
+			slot->out.timestamp = seq;
+			slot->release       = seq;
+			ring.end_write(slot, seq);
+			written++;
+		}
+		std::this_thread::sleep_for(std::chrono::microseconds(20));
+	}
+}
+
+static bool check_block(const AsioRing::Slot *slot, uint64_t seq)
+{
+	if (slot->out.timestamp != seq)
+		return false;
+	for (int c = 0; c < slot->channels; c++) {
+		const float *src = (const float *)slot->planes[c];
+		for (uint32_t i = 0; i < slot->out.frames; i++) {
+			if (src[i] != block_value(seq))
+				return false;
+		}
+	}
+	return true;
+}
+
+// reads everything it can, like a listener with no delay
+static void reader(AsioRing &ring, uint64_t &read)
+{
+	uint64_t read_seq = 0;
+	while (!stop.load()) {
+		{
+			AsioRing::ReadGuard guard(ring);
+			if (guard) {
+				auto take = [&](uint64_t seq, AsioRing::Slot &slot) {
+					if (!check_block(&slot, seq))
+						errors++;
+					read++;
+					return true;
+				};
+				ring.read(read_seq, take, [](uint64_t, uint64_t) {});
+			}
+		}
+		std::this_thread::sleep_for(std::chrono::microseconds(50));
+	}
+}
+
+// stays delay blocks behind the writer, every block it is owed must still be there
+static void delayed_reader(AsioRing &ring, std::atomic<int> &delay)
+{
+	uint64_t read_seq = UINT64_MAX;
+	int      seen     = relayouts.load();
+	while (!stop.load()) {
+		{
+			AsioRing::ReadGuard guard(ring);
+			uint64_t            write_seq = ring.write_sequence();
+			// a relayout throws the ring's contents away, start over behind the writer
+			if (guard && (read_seq == UINT64_MAX || seen != relayouts.load())) {
+				seen     = relayouts.load();
+				read_seq = write_seq;
+			}
+			if (guard) {
+				auto take = [&](uint64_t seq, AsioRing::Slot &slot) {
+					if (seq + delay.load() >= write_seq)
+						return false;
+					if (!check_block(&slot, seq))
+						errors++;
+					return true;
+				};
+				auto missed = [&](uint64_t, uint64_t count) {
+					delayed_lost += count;
+				};
+				ring.read(read_seq, take, missed);
+			}
+		}
+		std::this_thread::sleep_for(std::chrono::microseconds(50));
+	}
+}
+
+// keeps the lease on its newest block until the writer has gone all the way round the ring to it and had to drop
+// a block instead of writing over it, then checks the held block is still intact
+static void holding_reader(AsioRing &ring)
+{
+	while (!stop.load()) {
+		{
+			std::unique_lock<std::mutex> control(control_mutex, std::try_to_lock);
+			AsioRing::ReadGuard          guard(ring);
+			uint64_t                     read_seq = ring.write_sequence();
+			if (control && guard && read_seq) {
+				read_seq--;
+				auto take = [&](uint64_t seq, AsioRing::Slot &slot) {
+					uint64_t before  = dropped.load();
+					auto     limit   = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+					auto     wrapped = [&]() {
+						uint64_t round = seq + ring.size();
+						return ring.write_sequence() >= round && dropped.load() != before;
+					};
+					while (!stop.load() && !wrapped() && std::chrono::steady_clock::now() < limit)
+						std::this_thread::yield();
+					if (dropped.load() != before)
+						held_drops++;
+					if (!check_block(&slot, seq))
+						errors++;
+					return false;
+				};
+				ring.read(read_seq, take, [](uint64_t, uint64_t) {});
+			}
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+}
+
+// fills the ring with blocks and checks that grow() keeps every one of them readable
+static bool grow_keeps_blocks()
+{
+	AsioRing ring;
+	ring.close();
+	ring.layout(8, CHANNELS, FRAMES, AUDIO_FORMAT_FLOAT_PLANAR, 48000, nullptr);
+	ring.open();
+
+	for (uint64_t n = 0; n < 21; n++) {
+		uint64_t        seq   = 0;
+		int             index = 0;
+		AsioRing::Slot *slot  = ring.begin_write(seq, index);
+		if (!slot)
+			return false;
+		for (int c = 0; c < CHANNELS; c++) {
+			for (int i = 0; i < FRAMES; i++)
+				((float *)slot->planes[c])[i] = block_value(seq);
+		}
+		slot->out.frames    = FRAMES;
+		slot->out.timestamp = seq;
+		ring.end_write(slot, seq);
+	}
+	if (!ring.grow(32) || ring.size() != 32)
+		return false;
+
+	AsioRing::ReadGuard guard(ring);
+	for (uint64_t seq = 21 - 8; seq < 21; seq++) {
+		AsioRing::Lease lease;
+		if (!ring.lease(seq, lease) || !check_block(lease.get(), seq))
+			return false;
+	}
+	return true;
+}
+
+int main()
+{
+	if (!grow_keeps_blocks()) {
+		fprintf(stderr, "grow lost blocks\n");
+		return 1;
+	}
+
+	AsioRing ring;
+	ring.close();
+	ring.layout(8, CHANNELS, FRAMES, AUDIO_FORMAT_FLOAT_PLANAR, 48000, nullptr);
+	ring.open();
+
+	std::atomic<int>      delay   = {4};
+	uint64_t              written = 0;
+	std::vector<uint64_t> read(3, 0);
+
+	std::thread              dev(device, std::ref(ring), std::ref(written));
+	std::vector<std::thread> readers;
+	for (size_t i = 0; i < read.size(); i++)
+		readers.emplace_back(reader, std::ref(ring), std::ref(read[i]));
+	std::thread lagging(delayed_reader, std::ref(ring), std::ref(delay));
+	std::thread holding(holding_reader, std::ref(ring));
+
+	// the control thread's side: grow for longer delays, raising the delay only once the room is there, then
+	// lay the ring out again like a restart does
+	for (int slots = 16; slots <= 256; slots *= 2) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		std::lock_guard<std::mutex> control(control_mutex);
+		if (!ring.grow(slots)) {
+			fprintf(stderr, "could not grow to %d slots\n", slots);
+			errors++;
+		}
+		delay = slots / 2;
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	{
+		std::lock_guard<std::mutex> control(control_mutex);
+		ring.close();
+		ring.layout(256, CHANNELS, FRAMES, AUDIO_FORMAT_FLOAT_PLANAR, 48000, nullptr);
+		relayouts++;
+		ring.open();
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	stop = true;
+	dev.join();
+	for (auto &t : readers)
+		t.join();
+	lagging.join();
+	holding.join();
+
+	uint64_t total_read = 0;
+	for (uint64_t r : read)
+		total_read += r;
+	printf("%llu blocks written, %llu dropped (%llu on held leases), %llu read, %llu lost by the delayed reader, "
+	       "%llu bad\n",
+			(unsigned long long)written, (unsigned long long)dropped.load(),
+			(unsigned long long)held_drops.load(), (unsigned long long)total_read,
+			(unsigned long long)delayed_lost.load(), (unsigned long long)errors.load());
+	bool ok = errors.load() == 0 && delayed_lost.load() == 0 && held_drops.load() > 0 && written > 0 &&
+		  total_read > 0;
+	return ok ? 0 : 1;
+}
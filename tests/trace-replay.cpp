@@ -0,0 +1,239 @@
+/*
+Copyright (C) 2019 by andersama <anderson.john.alexander@gmail.com>
+and pkv <pkv.stream@gmail.com>.
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Replays a callback timing trace offline, on a virtual clock.
+ *
+ *   asio-trace-replay <file.asiotrace> [--jitter] [--delay <frames>] [--ideal-wakes]
+ *
+ * The recorded driver callbacks write into an AsioRing at their recorded times, optionally stamped by the
+ * JitterBuffer, and a listener reads it with the same ring walk and wait policy the dispatcher uses. Every step
+ * happens at a computed time instead of on a live thread, so the same trace always gives the same result. Only
+ * wakes at least 50us late are recorded live, so a replayed wake is late by the recorded lateness of the first
+ * listener's wake that was due in the same stretch of time and on time if there is none, or always on time with
+ * --ideal-wakes. Delivery lateness is how long after a block was due (released plus the delay) the
+ * listener handed it on. It is printed next to the lateness the trace recorded live.
+ */
+
+#include "asio-jitter.h"
+#include "asio-ring.h"
+#include "asio-trace.h"
+
+#include <util/util_uint64.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+static uint64_t frames_to_ns(int64_t frames, uint32_t sample_rate)
+{
+	return util_mul_div64((uint64_t)frames, 1000000000ULL, sample_rate);
+}
+
+static void print_lateness(const char *what, std::vector<uint64_t> &late)
+{
+	if (late.empty()) {
+		printf("%-9s no deliveries\n", what);
+		return;
+	}
+	std::sort(late.begin(), late.end());
+	uint64_t total = 0;
+	for (uint64_t l : late)
+		total += l;
+	printf("%-9s %zu blocks, lateness avg %llu us, p50 %llu us, p99 %llu us, max %llu us\n", what, late.size(),
+			(unsigned long long)(total / late.size() / 1000),
+			(unsigned long long)(late[late.size() / 2] / 1000),
+			(unsigned long long)(late[late.size() - 1 - late.size() / 100] / 1000),
+			(unsigned long long)(late.back() / 1000));
+}
+
+int main(int argc, char **argv)
+{
+	const char *path   = nullptr;
+	bool        jitter = false;
+	bool        ideal  = false;
+	int64_t     delay  = 0;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--jitter") == 0)
+			jitter = true;
+		else if (strcmp(argv[i], "--ideal-wakes") == 0)
+			ideal = true;
+		else if (strcmp(argv[i], "--delay") == 0 && i + 1 < argc)
+			delay = atoll(argv[++i]);
+		else
+			path = argv[i];
+	}
+
+	asio_trace_header             header;
+	std::vector<asio_trace_event> events;
+	if (!path || !AsioTrace::load(path, header, events) || !header.sample_rate || !header.frames) {
+		fprintf(stderr, "usage: asio-trace-replay <file%s> [--jitter] [--delay <frames>] [--ideal-wakes]\n",
+				ASIO_TRACE_EXTENSION);
+		return 1;
+	}
+	uint32_t rate   = header.sample_rate;
+	int      frames = (int)header.frames;
+
+	// events from several threads can be recorded slightly out of order
+	std::stable_sort(events.begin(), events.end(),
+			[](const asio_trace_event &a, const asio_trace_event &b) { return a.time < b.time; });
+
+	// the replay stands in for one listener, the first one that delivered
+	int listener = -1;
+	for (const asio_trace_event &ev : events) {
+		if (ev.type == ASIO_TRACE_DELIVER) {
+			listener = ev.index;
+			break;
+		}
+	}
+
+	struct late_wake {
+		uint64_t due;
+		uint64_t late;
+	};
+	std::vector<asio_trace_event> arrivals;
+	std::vector<late_wake>        wakes;
+	std::vector<uint64_t>         recorded;
+	std::vector<uint64_t>         callback_time;
+	uint64_t                      first_seq = UINT64_MAX;
+	for (const asio_trace_event &ev : events) {
+		if (ev.type == ASIO_TRACE_CALLBACK || ev.type == ASIO_TRACE_OVERRUN)
+			arrivals.push_back(ev);
+		if (ev.type == ASIO_TRACE_CALLBACK)
+			first_seq = std::min(first_seq, ev.seq);
+		// time is when the wake came and frames how many microseconds after it was due
+		if (ev.type == ASIO_TRACE_WAKE && ev.index == listener)
+			wakes.push_back({ev.time - (uint64_t)ev.frames * 1000, (uint64_t)ev.frames * 1000});
+	}
+	std::sort(wakes.begin(), wakes.end(), [](const late_wake &a, const late_wake &b) { return a.due < b.due; });
+	if (arrivals.empty()) {
+		fprintf(stderr, "no driver callbacks in %s\n", path);
+		return 1;
+	}
+	// what the live listeners achieved, against the arrival of each block they delivered
+	for (const asio_trace_event &ev : events) {
+		if (ev.type == ASIO_TRACE_CALLBACK) {
+			if (callback_time.size() <= ev.seq - first_seq)
+				callback_time.resize(ev.seq - first_seq + 1, 0);
+			callback_time[ev.seq - first_seq] = ev.time;
+		}
+	}
+	for (const asio_trace_event &ev : events) {
+		if (ev.type != ASIO_TRACE_DELIVER || ev.seq < first_seq || ev.seq - first_seq >= callback_time.size())
+			continue;
+		uint64_t arrived = callback_time[ev.seq - first_seq];
+		if (arrived && ev.time >= arrived)
+			recorded.push_back(ev.time - arrived);
+	}
+
+	// sized the way AudioCB sizes it for this block size and delay
+	int slots = std::max(8, (AUDIO_OUTPUT_FRAMES * 2) / frames);
+	if (delay > 0) {
+		int64_t capacity = frames;
+		while (capacity < delay)
+			capacity *= 2;
+		slots += (int)(capacity / frames) + 1;
+	}
+	AsioRing ring;
+	ring.close();
+	ring.layout(slots, (int)header.channels, frames, AUDIO_FORMAT_FLOAT_PLANAR, rate, nullptr);
+	ring.open();
+
+	JitterBuffer          jb;
+	uint64_t              max_depth = frames_to_ns(std::max(AUDIO_OUTPUT_FRAMES, frames * 4), rate);
+	uint64_t              delay_ns  = frames_to_ns(delay, rate);
+	std::vector<uint64_t> late;
+	uint64_t              overruns  = 0;
+	uint64_t              missed    = 0;
+	uint64_t              read_seq  = 0;
+	int                   wait_time = 4;
+	size_t                next_wake = 0;
+	size_t                a         = 0;
+	uint64_t              wake      = arrivals[0].time;
+
+	while (a < arrivals.size() || read_seq != ring.write_sequence()) {
+		// driver callback, ahead of a listener wake at the same time
+		if (a < arrivals.size() && arrivals[a].time <= wake) {
+			const asio_trace_event &ev      = arrivals[a++];
+			uint64_t                stamp   = ev.time;
+			uint64_t                release = ev.time;
+			if (jitter)
+				jb.schedule(ev.time, frames_to_ns(ev.frames, rate), max_depth, stamp, release);
+			uint64_t        seq   = 0;
+			int             index = 0;
+			AsioRing::Slot *slot  = ring.begin_write(seq, index);
+			if (!slot) {
+				overruns++;
+				continue;
+			}
+			slot->out.frames          = std::min((int)ev.frames, frames);
+			slot->out.timestamp       = stamp;
+			slot->out.samples_per_sec = rate;
+			slot->release             = release;
+			ring.end_write(slot, seq);
+			continue;
+		}
+
+		// listener pass at the virtual time wake
+		uint64_t now  = wake;
+		int      wait = wait_time;
+		{
+			AsioRing::ReadGuard guard(ring);
+			if (guard && read_seq != ring.write_sequence()) {
+				int      max_sample_rate = 0;
+				uint64_t next_release    = 0;
+
+				auto take = [&](uint64_t, AsioRing::Slot &slot) {
+					uint64_t due = slot.release + delay_ns;
+					if (due > now) {
+						next_release = due;
+						return false;
+					}
+					late.push_back(now - due);
+					max_sample_rate = std::max(max_sample_rate, (int)slot.out.samples_per_sec);
+					return true;
+				};
+				auto lost = [&](uint64_t, uint64_t count) {
+					missed += count;
+				};
+				ring.read(read_seq, take, lost);
+				if (max_sample_rate)
+					wait_time = ring_reader_wait_ms(max_sample_rate, now, 0);
+				wait = ring_reader_wait_ms(max_sample_rate, now, next_release);
+			}
+		}
+		wake = now + (uint64_t)wait * 1000000;
+		// late if a recorded wake was due since the last one, else on time like the wakes the trace left out
+		uint64_t late = 0;
+		for (; next_wake < wakes.size() && wakes[next_wake].due <= wake; next_wake++) {
+			if (wakes[next_wake].due > now)
+				late = std::max(late, wakes[next_wake].late);
+		}
+		if (!ideal)
+			wake += late;
+	}
+
+	double seconds = (arrivals.back().time - arrivals.front().time) / 1e9;
+	printf("%s: %s, %u Hz, %d frames, %zu callbacks over %.1f s, ring of %d blocks, delay %lld frames%s%s\n",
+			path, header.device, rate, frames, arrivals.size(), seconds, slots, (long long)delay,
+			jitter ? ", jitter buffer" : "", ideal ? ", ideal wakes" : "");
+	print_lateness("replayed", late);
+	printf("%-9s %llu missed, %llu overruns\n", "", (unsigned long long)missed, (unsigned long long)overruns);
+	if (jitter)
+		printf("%-9s jitter buffer depth %.2f ms, callback jitter %.2f ms, %llu underruns\n", "",
+				jb.depth() / 1e6, jb.jitter() / 1e6, (unsigned long long)jb.underruns());
+	print_lateness("recorded", recorded);
+	return 0;
+}